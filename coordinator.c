@@ -0,0 +1,446 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "libmandel.h"
+#include "tile_protocol.h"
+#include "pixel_store.h"
+#include "dump_format.h"
+
+//splits a big render into tiles and farms them out to mandel5 -w worker processes over pipes.
+//a worker is any shell command speaking tile_protocol.h on stdin/stdout, so
+//"ssh otherbox ./mandel5 -w" puts a worker on another host
+
+#define MAX_WORKERS 256
+
+//a tile still running after SLOW_FACTOR times the average tile time gets handed out again
+//to an idle worker, whichever copy comes back first wins
+#define SLOW_FACTOR 4
+#define MIN_SLOW_SECONDS 1.0
+
+enum tile_state { PENDING, RUNNING, DONE };
+
+typedef struct {
+    pid_t pid;
+    int to, from;           //its stdin and stdout
+    int tile;               //tile in flight, -1 when idle
+    int dead;
+    double sent;
+    uint8_t *buf;           //response being read
+    size_t have, need;
+} worker;
+
+worker workers[MAX_WORKERS];
+int n_workers = 0;
+
+tile_request job;
+int tile_size = 64;
+int tiles_x, tiles_y;
+enum tile_state *state;
+int *copies;                //how many workers are on each tile
+pixel_store result;
+size_t recolored;           //pixels whose color changed from quantising the value
+dump_map dump;              //exact values for recolor, when -d is given
+
+double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int spawn(worker *w, const char *cmd)
+{
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) < 0 || pipe2(out, O_CLOEXEC) < 0)
+        return 0;
+
+    w->pid = fork();
+    if (w->pid < 0)
+        return 0;
+    //its own process group, so bury reaches whatever the shell started and not just sh
+    if (w->pid == 0)
+    {
+        setpgid(0, 0);
+        dup2(in[0], 0);
+        dup2(out[1], 1);
+        execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+        _exit(127);
+    }
+    setpgid(w->pid, w->pid);
+
+    close(in[0]);
+    close(out[1]);
+    w->to = in[1];
+    w->from = out[0];
+    fcntl(w->from, F_SETFL, O_NONBLOCK);
+    w->tile = -1;
+    w->dead = 0;
+    w->buf = malloc(TILE_RESPONSE_HEADER + (size_t) tile_size*tile_size*TILE_PIXEL_SIZE);
+    w->have = 0;
+    w->need = TILE_RESPONSE_HEADER;
+    if (!w->buf)
+    {
+        close(w->to);
+        close(w->from);
+        kill(-w->pid, SIGTERM);
+        waitpid(w->pid, NULL, 0);
+        return 0;
+    }
+    return 1;
+}
+
+//give up on a worker, its tile goes back in the queue unless another copy is still running
+void bury(worker *w)
+{
+    if (w->dead)
+        return;
+    fprintf(stderr, "\nworker %d died\n", (int) w->pid);
+    w->dead = 1;
+    close(w->to);
+    close(w->from);
+    kill(-w->pid, SIGTERM);
+    waitpid(w->pid, NULL, 0);
+    if (w->tile >= 0 && --copies[w->tile] == 0 && state[w->tile] == RUNNING)
+        state[w->tile] = PENDING;
+    w->tile = -1;
+}
+
+//where a tile sits in the image, tiles on the right and bottom edge are cut short
+void tile_rect(int tile, int *x0, int *y0, int *w, int *h)
+{
+    *x0 = (tile % tiles_x) * tile_size;
+    *y0 = (tile / tiles_x) * tile_size;
+    *w = job.width - *x0 < tile_size ? job.width - *x0 : tile_size;
+    *h = job.height - *y0 < tile_size ? job.height - *y0 : tile_size;
+}
+
+int send_tile(worker *w, int tile)
+{
+    uint8_t buf[TILE_REQUEST_SIZE];
+    tile_request rq = job;
+
+    rq.id = tile;
+    tile_rect(tile, &rq.x0, &rq.y0, &rq.w, &rq.h);
+    encode_request(&rq, buf);
+
+    w->tile = tile;
+    w->sent = now();
+    w->have = 0;
+    w->need = TILE_RESPONSE_HEADER;
+    state[tile] = RUNNING;
+    copies[tile]++;
+    if (!write_full(w->to, buf, sizeof(buf)))
+    {
+        bury(w);
+        return 0;
+    }
+    return 1;
+}
+
+//next tile for an idle worker: anything pending, otherwise a copy of a tile that is overdue
+int pick_tile(double slow_after)
+{
+    int n = tiles_x*tiles_y;
+    for (int t = 0; t < n; t++)
+        if (state[t] == PENDING)
+            return t;
+
+    double t_now = now();
+    for (int i = 0; i < n_workers; i++)
+    {
+        worker *w = &workers[i];
+        if (!w->dead && w->tile >= 0 && state[w->tile] == RUNNING && copies[w->tile] == 1
+                && t_now - w->sent > slow_after)
+            return w->tile;
+    }
+    return -1;
+}
+
+//store a finished response, returns 1 if it completed a tile nobody had finished yet.
+//drain has already checked the header is the one for the worker's tile
+int take_result(worker *w)
+{
+    const uint8_t *p = w->buf + TILE_RESPONSE_HEADER;
+    int tile = w->tile, x0, y0, tw, th;
+    tile_rect(tile, &x0, &y0, &tw, &th);
+    int fresh = state[tile] != DONE;
+
+    if (fresh)
+        for (int y = y0; y < y0 + th; y++)
+            for (int x = x0; x < x0 + tw; x++)
+            {
+                size_t i = (size_t) y*job.width + x;
+                double value = get_f64(&p);
+                int depth = get_u32(&p);
+                unsigned char exact[3], stored[3];
+
+                store_put(&result, i, value, depth);
+                if (dump.header)
+                {
+                    dump.value[i] = value;
+                    dump.depth[i] = depth;
+                }
+                shade_bytes(value, depth, job.iterations, exact);
+                shade_bytes(store_value(&result, i), depth, job.iterations, stored);
+                recolored += memcmp(exact, stored, 3) != 0;
+            }
+
+    copies[tile]--;
+    state[tile] = DONE;
+    w->tile = -1;
+    return fresh;
+}
+
+//pull whatever the worker has written so far, returns 1 when a whole response is in
+int drain(worker *w)
+{
+    for (;;)
+    {
+        ssize_t got = read(w->from, w->buf + w->have, w->need - w->have);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0 && errno == EAGAIN)
+            return 0;
+        if (got <= 0)
+        {
+            bury(w);
+            return 0;
+        }
+        w->have += got;
+        if (w->have < w->need)
+            continue;
+
+        //anything but the tile it was sent is garbage, bury puts the tile back in the queue
+        if (w->need == TILE_RESPONSE_HEADER)
+        {
+            const uint8_t *p = w->buf;
+            int x0, y0, tw, th;
+            tile_rect(w->tile, &x0, &y0, &tw, &th);
+            uint32_t magic = get_u32(&p);
+            uint32_t id = get_u32(&p);
+            if (magic != TILE_MAGIC || id != (uint32_t) w->tile
+                    || get_u32(&p) != (uint32_t) tw || get_u32(&p) != (uint32_t) th)
+            {
+                fprintf(stderr, "\nworker %d sent garbage\n", (int) w->pid);
+                bury(w);
+                return 0;
+            }
+            w->need += (size_t) tw*th*TILE_PIXEL_SIZE;
+            continue;
+        }
+        return 1;
+    }
+}
+
+int write_ppm(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return 0;
+
+    fprintf(f, "P6\n%d %d\n255\n", job.width, job.height);
+    for (size_t i = 0; i < (size_t) job.width*job.height; i++)
+    {
+        unsigned char px[3];
+        shade_bytes(store_value(&result, i), store_depth(&result, i), job.iterations, px);
+        fwrite(px, 1, 3, f);
+    }
+    return fclose(f) == 0;
+}
+
+void usage(void)
+{
+    printf("coordinator [-W width] [-H height] [-f func] [-z zoom] [-c re im] [-l lo_re lo_im]\n"
+           "            [-r re im] [-i iterations] [-s] [-t tile] [-n workers] [-w cmd]...\n"
+           "            [-o out.ppm] [-d out.mdmp]\n");
+}
+
+int main(int argc, char* argv[])
+{
+    const char *cmds[MAX_WORKERS];
+    int n_cmds = 0;
+    int n = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *out = "out.ppm", *dump_path = NULL;
+
+    job = (tile_request) {.func = 1, .zoom = 100, .iterations = 10, .width = 500, .height = 500};
+
+    for (int i = 1; i<argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            usage();
+            return 1;
+        }
+        if (argv[i][1] == 's')
+        {
+            job.smoothing = 1;
+            continue;
+        }
+
+        int args = strchr("clr", argv[i][1]) ? 2 : 1;
+        if (argv[i][1] == 0 || i + args >= argc)
+        {
+            usage();
+            return 1;
+        }
+        double re = atof(argv[i+1]), im = args == 2 ? atof(argv[i+2]) : 0;
+
+        switch (argv[i][1])
+        {
+            case 'W': job.width = atoi(argv[i+1]); break;
+            case 'H': job.height = atoi(argv[i+1]); break;
+            case 'f': job.func = atoi(argv[i+1]); break;
+            case 'z': job.zoom = re; break;
+            case 'i': job.iterations = atoi(argv[i+1]); break;
+            case 't': tile_size = atoi(argv[i+1]); break;
+            case 'n': n = atoi(argv[i+1]); break;
+            case 'o': out = argv[i+1]; break;
+            case 'd': dump_path = argv[i+1]; break;
+            case 'w':
+                if (n_cmds < MAX_WORKERS)
+                    cmds[n_cmds++] = argv[i+1];
+                break;
+            case 'c': job.center_real = re; job.center_im = im; break;
+            case 'l': job.center_lo_real = re; job.center_lo_im = im; break;
+            case 'r': job.root_real = re; job.root_im = im; break;
+            default:
+                usage();
+                return 1;
+        }
+        i += args;
+    }
+
+    if (job.width <= 0 || job.height <= 0 || job.width > TILE_MAX_IMAGE || job.height > TILE_MAX_IMAGE
+            || tile_size <= 0 || tile_size > TILE_MAX_SIDE || job.iterations <= 0
+            || job.iterations > MAX_STORE_ITERATIONS)
+    {
+        usage();
+        return 1;
+    }
+
+    //no -w given, run local workers
+    if (n_cmds == 0)
+        for (; n_cmds < n && n_cmds < MAX_WORKERS; n_cmds++)
+            cmds[n_cmds] = "./mandel5 -w";
+
+    signal(SIGPIPE, SIG_IGN);
+    for (int i = 0; i < n_cmds; i++)
+        if (spawn(&workers[n_workers], cmds[i]))
+            n_workers++;
+
+    tiles_x = (job.width + tile_size - 1) / tile_size;
+    tiles_y = (job.height + tile_size - 1) / tile_size;
+    int n_tiles = tiles_x*tiles_y;
+    state = calloc(n_tiles, sizeof(*state));
+    copies = calloc(n_tiles, sizeof(*copies));
+    if (!state || !copies || !store_init(&result, (size_t) job.width*job.height, job.iterations))
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    //the raw dump is written straight into the mapped file as tiles come in
+    if (dump_path)
+    {
+        dump_header h = {.width = job.width, .height = job.height, .func = job.func,
+                         .iterations = job.iterations, .smoothing = job.smoothing,
+                         .root_real = job.root_real, .root_im = job.root_im,
+                         .center_real = job.center_real, .center_im = job.center_im,
+                         .center_lo_real = job.center_lo_real, .center_lo_im = job.center_lo_im,
+                         .zoom = job.zoom};
+        if (!dump_create(dump_path, &h, &dump))
+        {
+            perror(dump_path);
+            return 1;
+        }
+    }
+
+    int done = 0, shown = -1;
+    double start = now(), tile_seconds = 0;
+    struct pollfd fds[MAX_WORKERS];
+    int owner[MAX_WORKERS];
+
+    while (done < n_tiles)
+    {
+        double slow_after = fmax(MIN_SLOW_SECONDS, SLOW_FACTOR * (done ? tile_seconds / done : 0));
+        int alive = 0, nfds = 0;
+
+        for (int i = 0; i < n_workers; i++)
+        {
+            worker *w = &workers[i];
+            if (w->dead)
+                continue;
+            if (w->tile < 0)
+            {
+                int t = pick_tile(slow_after);
+                if (t >= 0 && !send_tile(w, t))
+                    continue;
+            }
+            alive++;
+            if (w->tile >= 0)
+            {
+                fds[nfds] = (struct pollfd) {w->from, POLLIN, 0};
+                owner[nfds++] = i;
+            }
+        }
+
+        if (alive == 0)
+        {
+            fprintf(stderr, "\nall workers are gone, %d of %d tiles done\n", done, n_tiles);
+            return 1;
+        }
+
+        //wake up now and then to hand out copies of overdue tiles
+        poll(fds, nfds, 100);
+        for (int k = 0; k < nfds; k++)
+        {
+            worker *w = &workers[owner[k]];
+            if (!fds[k].revents)
+                continue;
+            double sent = w->sent;
+            if (drain(w) && take_result(w))
+            {
+                done++;
+                tile_seconds += now() - sent;
+            }
+        }
+
+        if (done != shown)
+        {
+            fprintf(stderr, "\r%d/%d tiles, %d workers, %.1f s", done, n_tiles, alive, now() - start);
+            shown = done;
+        }
+    }
+    fprintf(stderr, "\n");
+    fprintf(stderr, "%.1f MB of results (%.1f MB as value_depth), value error up to %.2g, %zu pixels (%.4f%%) change color\n",
+            store_bytes(&result) / 1e6, result.n * 16 / 1e6, result.max_error,
+            recolored, 100.0 * recolored / result.n);
+
+    //eof on stdin stops the idle ones, anyone still on a duplicate tile is not waited for
+    for (int i = 0; i < n_workers; i++)
+        if (!workers[i].dead)
+        {
+            close(workers[i].to);
+            close(workers[i].from);
+            if (workers[i].tile >= 0)
+                kill(-workers[i].pid, SIGTERM);
+            waitpid(workers[i].pid, NULL, 0);
+        }
+
+    if (dump.header)
+        dump_close(&dump);
+    if (!write_ppm(out))
+    {
+        perror(out);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <math.h>
+
+//double-double numbers, hi + lo with |lo| <= half an ulp of hi, about 106 bits of mantissa.
+//built on fma so this must not be compiled with -ffast-math
+//see Hida, Li, Bailey "Library for Double-Double and Quad-Double Arithmetic"
+
+typedef struct {
+    double hi;
+    double lo;
+} dd;
+
+typedef struct {
+    dd real;
+    dd im;
+} dcomp;
+
+//exact a + b as a double-double
+static inline dd two_sum(double a, double b)
+{
+    double s = a + b;
+    double bb = s - a;
+    return (dd) {s, (a - (s - bb)) + (b - bb)};
+}
+
+//same as two_sum but only valid when |a| >= |b|
+static inline dd quick_two_sum(double a, double b)
+{
+    double s = a + b;
+    return (dd) {s, b - (s - a)};
+}
+
+static inline dd dd_add(dd a, dd b)
+{
+    dd s = two_sum(a.hi, b.hi);
+    dd t = two_sum(a.lo, b.lo);
+    s.lo += t.hi;
+    s = quick_two_sum(s.hi, s.lo);
+    s.lo += t.lo;
+    return quick_two_sum(s.hi, s.lo);
+}
+
+static inline dd dd_neg(dd a)
+{
+    return (dd) {-a.hi, -a.lo};
+}
+
+static inline dd dd_sub(dd a, dd b)
+{
+    return dd_add(a, dd_neg(b));
+}
+
+static inline dd dd_mul(dd a, dd b)
+{
+    double p = a.hi * b.hi;
+    double e = fma(a.hi, b.hi, -p);
+    e += a.hi * b.lo + a.lo * b.hi;
+    return quick_two_sum(p, e);
+}
+
+static inline dd dd_fabs(dd a)
+{
+    return a.hi < 0 ? dd_neg(a) : a;
+}
+
+static inline dcomp dc_add(dcomp a, dcomp b)
+{
+    return (dcomp) {dd_add(a.real, b.real), dd_add(a.im, b.im)};
+}
+
+static inline dcomp dc_mult(dcomp a, dcomp b)
+{
+    return (dcomp) {dd_sub(dd_mul(a.real, b.real), dd_mul(a.im, b.im)),
+                    dd_add(dd_mul(a.real, b.im), dd_mul(a.im, b.real))};
+}
+
+//magnitude is only used for escape tests and coloring, the high parts are plenty
+static inline double dc_abs(dcomp a)
+{
+    return sqrt(a.real.hi * a.real.hi + a.im.hi * a.im.hi);
+}
@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//raw per pixel results plus the view they came from, so a render can be recolored later
+//without iterating again. laid out to be mmapped as is on little endian machines:
+//
+//    offset 0    dump_header, DUMP_HEADER_SIZE bytes
+//    offset 128  f64 value[width*height], row by row
+//    then        i32 depth[width*height], row by row
+//
+//value and depth are what the kernels return, depth == iterations means inside.
+//the view maps pixel X Y to (X - width/2)/zoom - center, like mandel5 and tile_protocol.h
+
+#define DUMP_MAGIC "MANDDUMP"
+#define DUMP_VERSION 1
+#define DUMP_HEADER_SIZE 128
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t width, height;
+    int32_t func;
+    int32_t iterations;
+    int32_t smoothing;
+    int32_t pad;
+    double root_real, root_im;
+    double center_real, center_im;
+    double center_lo_real, center_lo_im;
+    double zoom;
+    uint8_t reserved[32];
+} dump_header;
+
+_Static_assert(sizeof(dump_header) == DUMP_HEADER_SIZE, "dump header layout");
+
+typedef struct {
+    dump_header *header;
+    double *value;
+    int32_t *depth;
+    size_t size;
+} dump_map;
+
+static inline size_t dump_size(uint32_t width, uint32_t height)
+{
+    return DUMP_HEADER_SIZE + (size_t) width*height*(sizeof(double) + sizeof(int32_t));
+}
+
+static inline void dump_point(dump_map *m)
+{
+    size_t n = (size_t) m->header->width * m->header->height;
+    m->value = (double *) ((uint8_t *) m->header + DUMP_HEADER_SIZE);
+    m->depth = (int32_t *) (m->value + n);
+}
+
+//make a new dump file of the header's size and map it for writing, returns 0 on failure
+int dump_create(const char *path, const dump_header *h, dump_map *m)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return 0;
+    m->size = dump_size(h->width, h->height);
+    if (ftruncate(fd, m->size) < 0)
+    {
+        close(fd);
+        return 0;
+    }
+    m->header = mmap(NULL, m->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m->header == MAP_FAILED)
+        return 0;
+
+    *m->header = *h;
+    memcpy(m->header->magic, DUMP_MAGIC, 8);
+    m->header->version = DUMP_VERSION;
+    m->header->header_size = DUMP_HEADER_SIZE;
+    dump_point(m);
+    return 1;
+}
+
+//map an existing dump read only, returns 0 if it is missing, truncated or not a dump
+int dump_open(const char *path, dump_map *m)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < DUMP_HEADER_SIZE)
+    {
+        close(fd);
+        return 0;
+    }
+    m->size = st.st_size;
+    m->header = mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m->header == MAP_FAILED)
+        return 0;
+
+    dump_header *h = m->header;
+    if (memcmp(h->magic, DUMP_MAGIC, 8) != 0 || h->version != DUMP_VERSION
+            || h->header_size != DUMP_HEADER_SIZE || dump_size(h->width, h->height) != m->size)
+    {
+        munmap(m->header, m->size);
+        return 0;
+    }
+    dump_point(m);
+    return 1;
+}
+
+void dump_close(dump_map *m)
+{
+    munmap(m->header, m->size);
+}
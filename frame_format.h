@@ -0,0 +1,135 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+//pixel formats stdin-sdl understands, on stdin and in a shm_ring.h ring. samples wider than
+//a byte are little endian. yuv420 is planar I420: a Y plane of rows lines of stride bytes,
+//then U and V planes at half the width and height with half the stride, rounded up
+enum frame_format { FMT_RGB332, FMT_GRAY8, FMT_GRAY16, FMT_RGB24, FMT_RGBA32, FMT_YUV420, N_FORMATS };
+
+static const struct {
+    const char *name;
+    int bytes;          //per pixel, per Y sample for yuv420
+} frame_formats[N_FORMATS] = {
+    {"rgb332", 1},      //the original one byte format, bits 0-2 red, 3-5 green, 6-7 blue
+    {"gray8", 1},
+    {"gray16", 2},
+    {"rgb24", 3},
+    {"rgba32", 4},
+    {"yuv420", 1},
+};
+
+//-1 if there is no format called name
+static inline int format_by_name(const char *name)
+{
+    for (int f = 0; f < N_FORMATS; f++)
+        if (strcmp(name, frame_formats[f].name) == 0)
+            return f;
+    return -1;
+}
+
+static inline size_t min_stride(int format, int cols)
+{
+    return (size_t) cols * frame_formats[format].bytes;
+}
+
+static inline size_t chroma_stride(size_t stride)
+{
+    return (stride + 1) / 2;
+}
+
+static inline size_t frame_bytes(int format, int rows, size_t stride)
+{
+    size_t n = stride * rows;
+    if (format == FMT_YUV420)
+        n += 2 * chroma_stride(stride) * ((rows + 1) / 2);
+    return n;
+}
+
+//converting rows of the packed formats into 0xAARRGGBB pixels, 16 at a time with GCC vector
+//extensions and the leftovers one by one. yuv420 is not packed and has no converter
+typedef void (*row_converter)(uint32_t *out, const uint8_t *in, int n);
+
+typedef uint8_t v16u8 __attribute__((vector_size(16)));
+typedef uint16_t v16u16 __attribute__((vector_size(32)));
+typedef uint32_t v16u32 __attribute__((vector_size(64)));
+
+static inline uint32_t rgb332(uint32_t c)
+{
+    return 0xff000000u | (c & 7) << 21 | (c >> 3 & 7) << 13 | (c >> 6 & 3) << 5;
+}
+
+static void rgb332_row(uint32_t *out, const uint8_t *in, int n)
+{
+    int x = 0;
+    for (; x + 16 <= n; x += 16)
+    {
+        v16u8 b;
+        memcpy(&b, in + x, sizeof(b));
+        v16u32 c = __builtin_convertvector(b, v16u32);
+        v16u32 p = 0xff000000u | (c & 7) << 21 | (c >> 3 & 7) << 13 | (c >> 6 & 3) << 5;
+        memcpy(out + x, &p, sizeof(p));
+    }
+    for (; x < n; x++)
+        out[x] = rgb332(in[x]);
+}
+
+static void gray8_row(uint32_t *out, const uint8_t *in, int n)
+{
+    int x = 0;
+    for (; x + 16 <= n; x += 16)
+    {
+        v16u8 g;
+        memcpy(&g, in + x, sizeof(g));
+        v16u32 p = __builtin_convertvector(g, v16u32) * 0x010101u | 0xff000000u;
+        memcpy(out + x, &p, sizeof(p));
+    }
+    for (; x < n; x++)
+        out[x] = 0xff000000u | in[x] * 0x010101u;
+}
+
+//the display has 8 bits per channel, the top byte of each sample is what shows
+static void gray16_row(uint32_t *out, const uint8_t *in, int n)
+{
+    int x = 0;
+    for (; x + 16 <= n; x += 16)
+    {
+        v16u16 g;
+        memcpy(&g, in + 2*x, sizeof(g));
+        v16u32 p = __builtin_convertvector(g >> 8, v16u32) * 0x010101u | 0xff000000u;
+        memcpy(out + x, &p, sizeof(p));
+    }
+    for (; x < n; x++)
+        out[x] = 0xff000000u | in[2*x + 1] * 0x010101u;
+}
+
+//three bytes don't fit a vector lane, gcc does what it can with this
+static void rgb24_row(uint32_t *out, const uint8_t *in, int n)
+{
+    for (int x = 0; x < n; x++, in += 3)
+        out[x] = 0xff000000u | in[0] << 16 | in[1] << 8 | in[2];
+}
+
+//bytes r g b a, read as little endian words. alpha is dropped, frames are shown opaque
+static void rgba32_row(uint32_t *out, const uint8_t *in, int n)
+{
+    int x = 0;
+    for (; x + 16 <= n; x += 16)
+    {
+        v16u32 w;
+        memcpy(&w, in + 4*x, sizeof(w));
+        v16u32 p = 0xff000000u | (w & 0xff) << 16 | (w & 0xff00) | (w >> 16 & 0xff);
+        memcpy(out + x, &p, sizeof(p));
+    }
+    for (; x < n; x++)
+        out[x] = 0xff000000u | in[4*x] << 16 | in[4*x + 1] << 8 | in[4*x + 2];
+}
+
+static inline row_converter format_converter(int format)
+{
+    static const row_converter converters[N_FORMATS] = {
+        rgb332_row, gray8_row, gray16_row, rgb24_row, rgba32_row, NULL
+    };
+    return converters[format];
+}
@@ -7,43 +7,196 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <setjmp.h>
+#include <unistd.h>
+#include <pthread.h>
 
-bool debug_catch_sigsegv_mode = true;
-static jmp_buf jbuf;
+//reading memory that may not be there: a probe that faults jumps back to where it started
+//instead of killing the process. what a probe needs is kept per thread, so any number of
+//threads can probe at once, each after probe_thread_init. a fault outside a probe still
+//crashes the way it would without the handler
 
-void debug_signal_handler(int signo)
+#define PROBE_MAX_THREADS 64
+
+static _Thread_local sigjmp_buf probe_jbuf;
+static _Thread_local volatile sig_atomic_t probing;
+static _Thread_local void *alt_stack;
+
+//runs on the thread's own alternate stack, so a thread that ran out of stack still gets here
+static void debug_signal_handler(int signo, siginfo_t *info, void *context)
 {
-    if(debug_catch_sigsegv_mode) {
-        printf("\nsignal_handler: received %d\n", signo);
-        siglongjmp(jbuf, 1);
-    } else {
-        printf("oops");
-        signal(SIGSEGV, debug_signal_handler);
+    (void) info;
+    (void) context;
+    if (probing)
+    {
+        probing = 0;
+        siglongjmp(probe_jbuf, 1);
     }
+    //not a probe: back to the default action, the faulting instruction runs again and
+    //the process dies of it
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigaction(signo, &sa, NULL);
 }
 
+//give the calling thread a stack for the handler, every thread that probes needs one.
+//returns 0 if it couldn't
+int probe_thread_init(void)
+{
+    if (alt_stack)
+        return 1;
+    size_t size = SIGSTKSZ > 65536 ? SIGSTKSZ : 65536;
+    stack_t ss = {.ss_sp = malloc(size), .ss_size = size};
+    if (!ss.ss_sp || sigaltstack(&ss, NULL) < 0)
+    {
+        free(ss.ss_sp);
+        return 0;
+    }
+    alt_stack = ss.ss_sp;
+    return 1;
+}
+
+void probe_thread_done(void)
+{
+    if (!alt_stack)
+        return;
+    stack_t ss = {.ss_flags = SS_DISABLE};
+    sigaltstack(&ss, NULL);
+    free(alt_stack);
+    alt_stack = NULL;
+}
+
+//catch SIGSEGV and SIGBUS (a file mapped past its end) for the whole process, and set up the
+//calling thread for probing
 void debug_enable_sigsev_handler() {
-    if(signal(SIGSEGV, debug_signal_handler) == SIG_ERR) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = debug_signal_handler;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGSEGV, &sa, NULL) < 0 || sigaction(SIGBUS, &sa, NULL) < 0
+            || !probe_thread_init()) {
         printf("enable_sigsev_handler: ERROR, can't catch SIGSEGV\n");
     }
 }
 
+//copy n bytes from src, 1 if they were all there. a fault can leave dst half written
+int probe_copy(void *dst, const void *src, size_t n)
+{
+    if (sigsetjmp(probe_jbuf, 1) != 0)
+        return 0;
+    probing = 1;
+    memcpy(dst, src, n);
+    probing = 0;
+    return 1;
+}
+
+//the sigsetjmp half of probe_range. a job is the only thing it reads past the jump back and
+//nothing writes to it after, so nothing the jump restores can be stale
+typedef struct {
+    uintptr_t first;
+    size_t pages, page;
+    uint8_t *bitmap;
+} probe_pages;
+
+static size_t probe_pages_run(const probe_pages *p)
+{
+    //these live on across the jump back from the handler
+    volatile size_t k = 0, valid = 0;
+    if (sigsetjmp(probe_jbuf, 1) != 0)
+        k++;                //page k faulted
+    probing = 1;
+    for (; k < p->pages; k++)
+    {
+        (void) *(volatile const uint8_t *) (p->first + k*p->page);
+        p->bitmap[k/8] |= 1 << k%8;
+        valid++;
+    }
+    probing = 0;
+    return valid;
+}
+
+//probe every page from the one start is on to the one start+len-1 is on. bit k of bitmap
+//(bitmap[k/8] >> k%8 & 1) says if page k of them can be read. returns how many can.
+//touching one byte is enough, protection comes in whole pages. a fault costs one signal,
+//a page that is there costs one read
+size_t probe_range(const void *start, size_t len, uint8_t *bitmap)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t first = (uintptr_t) start / page * page;
+    probe_pages p = {first, len ? ((uintptr_t) start + len - first + page - 1) / page : 0, page, bitmap};
+    memset(bitmap, 0, (p.pages + 7) / 8);
+    return probe_pages_run(&p);
+}
+
+typedef struct {
+    const uint8_t *start;
+    size_t len;
+    uint8_t *bitmap;
+    size_t valid;
+} probe_job;
+
+static void *probe_worker(void *arg)
+{
+    probe_job *job = arg;
+    if (probe_thread_init())
+    {
+        job->valid = probe_range(job->start, job->len, job->bitmap);
+        probe_thread_done();
+    }
+    return NULL;
+}
+
+//probe_range spread over n threads. each takes a share of whole bitmap bytes (8 pages), so
+//none of them write the same byte. with one thread it is just probe_range on this one
+size_t probe_range_threads(const void *start, size_t len, uint8_t *bitmap, int n)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t first = (uintptr_t) start / page * page;
+    size_t pages = len ? ((uintptr_t) start + len - first + page - 1) / page : 0;
+    size_t bytes = (pages + 7) / 8;
+    n = n < 1 ? 1 : n > PROBE_MAX_THREADS ? PROBE_MAX_THREADS : n;
+    if ((size_t) n > bytes)
+        n = bytes ? bytes : 1;
+    if (n == 1)
+        return probe_range(start, len, bitmap);
+
+    pthread_t threads[PROBE_MAX_THREADS];
+    probe_job jobs[PROBE_MAX_THREADS];
+    int started[PROBE_MAX_THREADS];
+    for (int i = 0; i < n; i++)
+    {
+        size_t from = bytes * i / n * 8, to = bytes * (i + 1) / n * 8;
+        to = to < pages ? to : pages;
+        jobs[i] = (probe_job) {(const uint8_t *) first + from*page, (to - from)*page, bitmap + from/8, 0};
+        started[i] = pthread_create(&threads[i], NULL, probe_worker, &jobs[i]) == 0;
+        if (!started[i])
+            jobs[i].valid = probe_range(jobs[i].start, jobs[i].len, jobs[i].bitmap);
+    }
+    size_t valid = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        valid += jobs[i].valid;
+    }
+    return valid;
+}
+
 void debug_print_pointer(const void* ptr)
 {
     long ptr_deref;
 
     printf("debug_print_pointer(%p) = ", ptr);
-    debug_catch_sigsegv_mode = true;
-    if(ptr != NULL && sigsetjmp(jbuf, !0) == 0) {
-        ptr_deref = *(long*)ptr;
+    if(ptr != NULL && probe_copy(&ptr_deref, ptr, sizeof(ptr_deref))) {
         printf("[%016lx]", ptr_deref);
     } else {
         printf("<my segmentation fault>");
     }
-    debug_catch_sigsegv_mode = false;
 
     printf("\n");
 }
-
@@ -0,0 +1,590 @@
+#pragma once
+#include <math.h>
+#include "color_custom.h"
+#include "double_double.h"
+
+//the fractal itself, shared by the mandel5 window, its -w tile workers and -e zoom videos,
+//coordinator and tileserver. nothing in here keeps state between calls: what to draw comes
+//in as a mandel_view and pixels go out through the caller's buffers
+//
+//pixel X Y of a width x height view is the point (X - width/2)/zoom - center, y going up
+
+enum function { MANDEL, JULIA, JULIA_3, SINKING_SHIP};
+
+//number type the kernels run in, see choose_precision
+enum precision { PREC_DOUBLE, PREC_DOUBLE_DOUBLE, PREC_FLOAT };
+
+//double runs out once a pixel is less than 2^-DD_ZOOM_BITS of the coordinates it sits at,
+//float is only tried while a pixel is more than 2^-FLOAT_ZOOM_BITS of them
+#define DD_ZOOM_BITS 42
+#define FLOAT_ZOOM_BITS 13
+
+//float is only kept if no more than 1 in FLOAT_MISMATCH of a FLOAT_CHECK_GRID^2 sample
+//of the view lands on a different depth than double
+#define FLOAT_CHECK_GRID 16
+#define FLOAT_MISMATCH 100
+
+//8 lanes of float, a single register with -march=native on anything with avx
+typedef float v8f __attribute__((vector_size(32)));
+typedef int v8i __attribute__((vector_size(32)));
+
+//complex number struct
+typedef struct {
+    double real;
+    double im;
+} comp;
+
+typedef struct {
+    double value;
+    int depth;
+} value_depth;
+
+//everything that decides what a pixel comes out as. a render only reads one of these and its
+//output buffer, so any number of threads can render the same or different views at once
+typedef struct {
+    enum function func;
+    comp julia_root;
+    comp center;
+    comp center_lo;     //bits of center below double precision, for deep zooms
+    double zoom;
+    int iterations;
+    int smoothing;
+    int width, height;  //of the whole image, pixel width/2 height/2 sits on the center
+    enum precision precision;
+} mandel_view;
+
+//suite of stub functions for manipulating complex number structs
+comp add(comp a, comp b)
+{
+    return (comp){a.real+b.real, a.im+b.im};
+}
+
+comp mult(comp a, comp b)
+{ 
+    return (comp){a.real*b.real - a.im*b.im, a.real*b.im + a.im*b.real};
+}
+
+double abs_im(comp a)
+{
+    return sqrtf(a.real * a.real + a.im * a.im);
+}
+
+double sqr(double x) 
+{
+    return x*x;
+}
+
+double cube(double x)
+{
+    return x*x*x;
+}
+
+double sign(double x)
+{
+    if (x > 0)
+        return 1;
+    return -1;
+}
+
+// ===================================
+// all of the fractal functions go here
+// each one iterates *z from step `from` up to iterations, adding c every step, and leaves *z
+// where it stopped so a pixel that hit the cap can be picked up again later
+// ===================================
+value_depth sinking_ship(comp *zp, comp c, int from, int iterations)
+{
+    comp z = *zp;
+    for (int i=from; i<iterations; i++)
+    {
+        z.real = fabs(z.real);
+        z.im = fabs(z.im);
+        z = add(mult(z, z), c);
+        if (abs_im(z) > 2)
+        {
+            *zp = z;
+            return (value_depth) {abs_im(z), i};
+        }
+    }
+    *zp = z;
+    return (value_depth) {0.0, iterations};
+}
+
+value_depth julia(comp *zp, comp c, int from, int iterations)
+{
+    comp z = *zp;
+    for (int i=from; i<iterations; i++)
+    {
+        
+        z = add(mult(z, z), c);
+        if (abs_im(z) > 2)
+        {
+            *zp = z;
+            return (value_depth) {abs_im(z), i};
+        }
+    }
+    *zp = z;
+    return (value_depth) {abs_im(z), iterations};
+}
+
+value_depth mandel_3(comp *zp, comp c, int from, int iterations)
+{
+    comp z = *zp;
+    for (int i=from; i<iterations; i++)
+    {
+        z = add(mult(z, mult(z, z)), c);
+        if (abs_im(z) > 2)
+        {
+            *zp = z;
+            return (value_depth) {abs_im(z), i};
+        }
+    }
+    *zp = z;
+    return (value_depth) {0.0, iterations};
+}
+
+value_depth mandel(comp *zp, comp c, int from, int iterations)
+{
+    comp z = *zp;
+    for (int i=from; i<iterations; i++)
+    {
+        z = add(mult(z, z), c);
+        if (abs_im(z) > 2)
+        {
+            *zp = z;
+            return (value_depth) {abs_im(z), i};
+        }
+    }
+    *zp = z;
+    return (value_depth) {0.0, iterations};
+}
+
+//convert from screen pixels to coordinates in the imaginary plane
+comp px_to_math(const mandel_view *v, double x, double y)
+{
+    return (comp) {(x - (v->width/2)) / v->zoom - v->center.real, 
+                          -((y - (v->height/2)) / v->zoom - v->center.im)};
+}
+
+// ===================================
+// double-double versions of the fractal functions, for zooms past what double can resolve
+// ===================================
+value_depth sinking_ship_dd(dcomp *zp, dcomp c, int from, int iterations)
+{
+    dcomp z = *zp;
+    for (int i=from; i<iterations; i++)
+    {
+        z.real = dd_fabs(z.real);
+        z.im = dd_fabs(z.im);
+        z = dc_add(dc_mult(z, z), c);
+        if (dc_abs(z) > 2)
+        {
+            *zp = z;
+            return (value_depth) {dc_abs(z), i};
+        }
+    }
+    *zp = z;
+    return (value_depth) {0.0, iterations};
+}
+
+value_depth julia_dd(dcomp *zp, dcomp c, int from, int iterations)
+{
+    dcomp z = *zp;
+    for (int i=from; i<iterations; i++)
+    {
+        z = dc_add(dc_mult(z, z), c);
+        if (dc_abs(z) > 2)
+        {
+            *zp = z;
+            return (value_depth) {dc_abs(z), i};
+        }
+    }
+    *zp = z;
+    return (value_depth) {dc_abs(z), iterations};
+}
+
+value_depth mandel_3_dd(dcomp *zp, dcomp c, int from, int iterations)
+{
+    dcomp z = *zp;
+    for (int i=from; i<iterations; i++)
+    {
+        z = dc_add(dc_mult(z, dc_mult(z, z)), c);
+        if (dc_abs(z) > 2)
+        {
+            *zp = z;
+            return (value_depth) {dc_abs(z), i};
+        }
+    }
+    *zp = z;
+    return (value_depth) {0.0, iterations};
+}
+
+value_depth mandel_dd(dcomp *zp, dcomp c, int from, int iterations)
+{
+    dcomp z = *zp;
+    for (int i=from; i<iterations; i++)
+    {
+        z = dc_add(dc_mult(z, z), c);
+        if (dc_abs(z) > 2)
+        {
+            *zp = z;
+            return (value_depth) {dc_abs(z), i};
+        }
+    }
+    *zp = z;
+    return (value_depth) {0.0, iterations};
+}
+
+// ===================================
+// float versions of the fractal functions, eight orbits side by side
+// ===================================
+static inline int any_lane(v8i m)
+{
+    for (int k = 0; k < 8; k++)
+        if (m[k])
+            return 1;
+    return 0;
+}
+
+static inline v8f blend(v8i mask, v8f a, v8f b)
+{
+    return (v8f) (((v8i) a & mask) | ((v8i) b & ~mask));
+}
+
+//each lane runs from its own depth up to iterations, a lane that escapes stops where it escaped.
+//returns the new depths, a lane escaped if its depth is under iterations
+v8i iterate_v8(enum function f, v8f *zrp, v8f *zip, v8f cr, v8f ci, v8i depth, int iterations)
+{
+    v8f zr = *zrp, zi = *zip;
+    v8f nr = zr, ni = zi, tr, ti;
+    v8i active = depth < iterations;
+
+    while (any_lane(active))
+    {
+        switch (f)
+        {
+            case MANDEL:
+            case JULIA:
+                nr = zr*zr - zi*zi + cr;
+                ni = zr*zi + zi*zr + ci;
+                break;
+
+            case JULIA_3:
+                tr = zr*zr - zi*zi;
+                ti = zr*zi + zi*zr;
+                nr = zr*tr - zi*ti + cr;
+                ni = zr*ti + zi*tr + ci;
+                break;
+
+            case SINKING_SHIP:
+                tr = (v8f) ((v8i) zr & 0x7fffffff);
+                ti = (v8f) ((v8i) zi & 0x7fffffff);
+                nr = tr*tr - ti*ti + cr;
+                ni = tr*ti + ti*tr + ci;
+                break;
+        }
+        zr = blend(active, nr, zr);
+        zi = blend(active, ni, zi);
+
+        v8i escaped = (zr*zr + zi*zi > 4) & active;
+        depth -= active & ~escaped;
+        active &= ~escaped & (depth < iterations);
+    }
+
+    *zrp = zr;
+    *zip = zi;
+    return depth;
+}
+
+//px_to_math with the full center_lo precision. the offset from the center is tiny
+//so it only needs to be a double
+dcomp px_to_math_dd(const mandel_view *v, double x, double y)
+{
+    dd cr = {v->center.real, v->center_lo.real};
+    dd ci = {v->center.im, v->center_lo.im};
+    return (dcomp) {dd_sub((dd) {(x - (v->width/2)) / v->zoom, 0}, cr),
+                    dd_sub(ci, (dd) {(y - (v->height/2)) / v->zoom, 0})};
+}
+
+static inline dcomp to_dcomp(comp a)
+{
+    return (dcomp) {{a.real, 0}, {a.im, 0}};
+}
+
+//double-double version of get_pixel, same setup as orbit_start
+void get_pixel_dd(const mandel_view *v, double x, double y, value_depth *vd)
+{
+    dcomp p = px_to_math_dd(v, x, y);
+    dcomp root = to_dcomp(v->julia_root);
+    dd shift_real = dd_sub(dd_mul(root.real, root.real), dd_mul(root.im, root.im));
+    dd shift_im = dd_mul((dd) {2, 0}, dd_mul(root.real, root.im));
+
+    switch (v->func)
+    {
+        case MANDEL://mandel
+            p.real = dd_sub(p.real, shift_real);
+            p.im = dd_sub(p.im, shift_im);
+            *vd = mandel_dd(&root, p, 0, v->iterations);
+            break;
+
+        case JULIA://julia
+            *vd = julia_dd(&p, root, 0, v->iterations);
+            break;
+
+        case JULIA_3://z^3+c
+            *vd = mandel_3_dd(&p, root, 0, v->iterations);
+            break;
+
+        case SINKING_SHIP://sinking ship
+            p.real = dd_sub(p.real, dd_fabs(shift_real));
+            p.im = dd_sub(p.im, dd_fabs(shift_im));
+            *vd = sinking_ship_dd(&root, p, 0, v->iterations);
+            break;
+    }
+}
+
+//pick the cheapest number type that still resolves a pixel at this zoom. z stays under 2
+//and the center can be anywhere, so whichever is bigger sets the ulp we are up against.
+//double-double holds about 106 bits, so past roughly 1e30 the picture breaks up again.
+//float is only a candidate here, see mandel_prepare
+void choose_precision(mandel_view *v)
+{
+    double scale = fmax(2, fmax(fabs(v->center.real), fabs(v->center.im)));
+    if (v->zoom * scale > ldexp(1, DD_ZOOM_BITS))
+        v->precision = PREC_DOUBLE_DOUBLE;
+    else if (v->zoom * scale <= ldexp(1, FLOAT_ZOOM_BITS))
+        v->precision = PREC_FLOAT;
+    else
+        v->precision = PREC_DOUBLE;
+}
+
+//starting z and the constant that gets added every step for the pixel at x y
+void orbit_start(const mandel_view *v, double x, double y, comp *z, comp *c)
+{
+    comp p = px_to_math(v, x, y);
+    comp julia_root = v->julia_root;
+    switch (v->func)
+    {
+        case MANDEL://mandel
+            p.real -=  sqr(julia_root.real) - sqr(julia_root.im);
+            p.im -= 2*(julia_root.real*julia_root.im);
+            *z = julia_root;
+            *c = p;
+            break;
+
+        case JULIA://julia
+        case JULIA_3://z^3+c
+            *z = p;
+            *c = julia_root;
+            break;
+
+        case SINKING_SHIP://sinking ship
+            p.real -=  fabs(sqr(julia_root.real) - sqr(julia_root.im));
+            p.im -= fabs(2*(julia_root.real*julia_root.im));
+            *z = julia_root;
+            *c = p;
+            break;
+    }
+}
+
+value_depth iterate(enum function f, comp *z, comp c, int from, int iterations)
+{
+    switch (f)
+    {
+        case MANDEL:
+            return mandel(z, c, from, iterations);
+        case JULIA:
+            return julia(z, c, from, iterations);
+        case JULIA_3:
+            return mandel_3(z, c, from, iterations);
+        case SINKING_SHIP:
+            return sinking_ship(z, c, from, iterations);
+    }
+    return (value_depth) {0.0, iterations};
+}
+
+//get values for pixel at x y
+void get_pixel(const mandel_view *v, double x, double y, value_depth *vd)
+{
+    if (v->precision == PREC_DOUBLE_DOUBLE)
+    {
+        get_pixel_dd(v, x, y, vd);
+        return;
+    }
+
+    comp z, c;
+    orbit_start(v, x, y, &z, &c);
+    *vd = iterate(v->func, &z, c, 0, v->iterations);
+}
+
+//run a grid of the view through the float kernel and double, and see if they agree
+int float_agrees(const mandel_view *v)
+{
+    mandel_view dv = *v;
+    value_depth vd;
+    int mismatched = 0;
+
+    dv.precision = PREC_DOUBLE;
+    for (int gy = 0; gy < FLOAT_CHECK_GRID; gy++)
+        for (int gx = 0; gx < FLOAT_CHECK_GRID; gx += 8)
+        {
+            v8f zr, zi, cr, ci;
+            v8i depth = {0};
+            int ref[8];
+
+            for (int l = 0; l < 8; l++)
+            {
+                double x = (gx + l + 0.5) * v->width / FLOAT_CHECK_GRID;
+                double y = (gy + 0.5) * v->height / FLOAT_CHECK_GRID;
+                comp z, c;
+                orbit_start(&dv, x, y, &z, &c);
+                zr[l] = z.real;
+                zi[l] = z.im;
+                cr[l] = c.real;
+                ci[l] = c.im;
+                get_pixel(&dv, x, y, &vd);
+                ref[l] = vd.depth;
+            }
+
+            depth = iterate_v8(v->func, &zr, &zi, cr, ci, depth, v->iterations);
+            for (int l = 0; l < 8; l++)
+                mismatched += depth[l] != ref[l];
+        }
+
+    return mismatched * FLOAT_MISMATCH <= FLOAT_CHECK_GRID*FLOAT_CHECK_GRID;
+}
+
+//funtion for choosing which value to keep for mulitple depth readings
+int zero_or_max(int running, int new)
+{
+    if (new ==0)
+        return 0;
+    if (new > running)
+        return new;
+    return running;
+}
+
+//four samples a quarter pixel off in each direction
+void get_pixel_smoothed(const mandel_view *vw, double x, double y, value_depth *out)
+{
+    double v = 0.0;
+    int d = 0;
+    value_depth vd;
+
+    //get x y in a complex number and adjust for the drift
+    //aka move to center the origin as the so-called "julia number" changes
+    get_pixel(vw, x+0.25, y+0.25, &vd);
+    v += vd.value; 
+    d = zero_or_max(d, vd.depth);
+
+    get_pixel(vw, x-0.25, y+0.25, &vd);
+    v += vd.value; 
+    d = zero_or_max(d, vd.depth);
+
+    get_pixel(vw, x-0.25, y-0.25, &vd);
+    v += vd.value; 
+    d = zero_or_max(d, vd.depth);
+    
+    get_pixel(vw, x+0.25, y-0.25, &vd);
+    v += vd.value; 
+    d = zero_or_max(d, vd.depth);
+
+    *out = (value_depth) {v / 4, d};
+}
+
+//turn an escape value and depth into a color
+rgb shade_rgb(double v, int d, int iterations)
+{
+    //convert to RGB for rendering
+    hsv HSV = {0, 0.8, 0.8};
+
+    if (d==iterations)//if in the middle
+    {
+    HSV.h = 0;
+    HSV.v = 3*(fmod(v/12.5, 1)+ 0.5*(d/iterations));
+    HSV.s = 0;                
+    }
+    else
+    {
+    HSV.h = 300 - 300*((double) d/iterations);
+    HSV.v = 1- 0.5*fmod(v/12.5, 1) + 0.5*(d/iterations) ;
+    HSV.s = 0.9 -0.9*((double) d/iterations);
+    }
+
+    return hsv2rgb(HSV);
+}
+
+//an rgb as three bytes. bright interiors go past 1, wrap them the way the Uint8 arguments of
+//SDL_MapRGB do so files come out the same as the window
+void put_rgb(rgb RGB, unsigned char px[3])
+{
+    px[0] = (int) (RGB.r*256);
+    px[1] = (int) (RGB.g*256);
+    px[2] = (int) (RGB.b*256);
+}
+
+//shade_rgb as the red, green and blue bytes of an image file
+void shade_bytes(double v, int d, int iterations, unsigned char px[3])
+{
+    put_rgb(shade_rgb(v, d, iterations), px);
+}
+
+//settle the precision v renders in. float is only kept if try_float and float_agrees, which
+//costs a few hundred pixels in double, otherwise it is done in double
+void mandel_prepare(mandel_view *v, int try_float)
+{
+    choose_precision(v);
+    if (v->precision == PREC_FLOAT && !(try_float && float_agrees(v)))
+        v->precision = PREC_DOUBLE;
+}
+
+//n pixels of row y from x0 in float, eight at a time
+static void render_row_float(const mandel_view *v, int x0, int y, int n, value_depth *out)
+{
+    for (int x = 0; x < n; x += 8)
+    {
+        v8f zr, zi, cr, ci;
+        v8i depth;
+        int lanes = n - x < 8 ? n - x : 8;
+
+        //spare lanes start out finished so they never run
+        for (int l = 0; l < 8; l++)
+        {
+            comp z = {0, 0}, c = {0, 0};
+            if (l < lanes)
+                orbit_start(v, x0 + x + l, y, &z, &c);
+            zr[l] = z.real;
+            zi[l] = z.im;
+            cr[l] = c.real;
+            ci[l] = c.im;
+            depth[l] = l < lanes ? 0 : v->iterations;
+        }
+
+        depth = iterate_v8(v->func, &zr, &zi, cr, ci, depth, v->iterations);
+        for (int l = 0; l < lanes; l++)
+        {
+            int escaped = depth[l] < v->iterations;
+            out[x + l] = (value_depth) {escaped || v->func == JULIA ? abs_im((comp) {zr[l], zi[l]}) : 0.0, depth[l]};
+        }
+    }
+}
+
+//render the w x h pixels of v from x0 y0 into out, rows stride value_depths apart.
+//mandel_prepare v first
+void mandel_render(const mandel_view *v, int x0, int y0, int w, int h, value_depth *out, size_t stride)
+{
+    for (int y = y0; y < y0 + h; y++, out += stride)
+    {
+        if (v->precision == PREC_FLOAT && !v->smoothing)
+        {
+            render_row_float(v, x0, y, w, out);
+            continue;
+        }
+        for (int x = 0; x < w; x++)
+        {
+            if (v->smoothing)
+                get_pixel_smoothed(v, x0 + x, y, &out[x]);
+            else
+                get_pixel(v, x0 + x, y, &out[x]);
+        }
+    }
+}
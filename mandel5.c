@@ -1,34 +1,68 @@
 #include <stdio.h>
 #include <SDL.h>
 #include <math.h>
-#include "color_custom.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "libmandel.h"
+#include "tile_protocol.h"
 #define WIDTH 500
 #define HEIGHT 500
 #define BPP 4
 #define DEPTH 32
 
-enum function { MANDEL, JULIA, JULIA_3, SINKING_SHIP};
+//screen is split into square tiles that the worker threads claim one at a time
+//compr_level never goes over 32 so a compressed block never crosses a tile edge
+#define TILE 32
+#define TILES_X ((WIDTH + TILE - 1) / TILE)
+#define TILES_Y ((HEIGHT + TILE - 1) / TILE)
+#define MAX_THREADS 64
+
 enum function func = JULIA;
 
+//mirror image of the view that comes for free, see find_symmetry
+enum symmetry { NO_SYMMETRY, CONJUGATE, ROTATE_180 };
+
 int compr_level = 1;
 int smoothing = 0;
 
-//complex number struct
-typedef struct {
-    double real;
-    double im;
-} comp;
+//draw orbit density (buddhabrot) instead of escape time
+int buddha = 0;
+
+//atlas of julia thumbnails, one per julia_root over the view, instead of the view itself
+int atlas = 0;
 
+//snapshot of everything needed to draw a frame, the workers only ever see one of these
+//so the event loop is free to keep changing the globals below while a frame is in flight
 typedef struct {
+    mandel_view m;      //the picture, the rest is how the window draws it
+    int compr_level;
+    int buddha;
+    int atlas;
+    unsigned epoch;     //changes whenever anything but iterations, compr_level or smoothing does
+    enum symmetry symmetry;
+    int mirror_x, mirror_y;     //pixel x y mirrors onto mirror_x - x, mirror_y - y
+} view;
+
+//saved orbit of a screen pixel, only trusted while epoch matches the view being drawn
+typedef struct {
+    comp z;
     double value;
-    int depth;
-} value_depth;
+    int depth;          //escape depth, or how far z has been iterated if it has not escaped
+    int escaped;
+    unsigned epoch;
+} orbit;
 
 //starting point for z
 comp julia_root = {0, 0};
 
-//viewing center
+//viewing center, center_lo holds what does not fit in a double once zoomed far in
 comp center = {0, 0};
+comp center_lo = {0, 0};
 
 //zoom level
 double zoom = 100;
@@ -36,6 +70,111 @@ double zoom = 100;
 //how many iterations to calculate for each pixel
 int iterations = 10;
 
+//finished pixels, workers write whole tiles in here and the main thread copies it to the screen
+Uint32 framebuf[WIDTH*HEIGHT];
+pthread_mutex_t frame_lock = PTHREAD_MUTEX_INITIALIZER;
+SDL_PixelFormat *pixel_format;
+
+//orbits of every pixel, so raising iterations only has to run the pixels that hit the cap.
+//a stale worker can still be finishing a row of a tile when the new frame reaches it,
+//so a tile's orbits are only touched with its lock held
+orbit orbits[WIDTH*HEIGHT];
+pthread_mutex_t tile_locks[TILES_X*TILES_Y];
+
+//bumped every time the view changes. the tile counters carry the generation in their
+//top 32 bits so a worker that is still on an old view can never claim or finish a new tile
+atomic_uint generation;
+atomic_ullong next_tile;
+atomic_ullong tiles_done;
+atomic_int dirty;
+
+int n_workers;
+
+//buddhabrot. every worker splats orbits into its own histogram, the main thread sums them for
+//display. the c plane from -2 to 2 is cut into BUDDHA_CELLS^2 cells that are probed, and
+//cells where an escaping orbit crossed the screen are live. samples pick a cell uniformly and
+//keep every live one but only one in BUDDHA_DEAD_WEIGHT of the others, which then splat with
+//that weight, so rare orbits from cells the probe missed still add up to the right density.
+//a cell's probe result is tagged with the generation it was probed for, gen << 1 | hit, so a
+//worker still finishing an old view can't mark cells of the new one, and a cell nobody has
+//probed yet counts as dead: sampling starts while other workers are still probing
+#define BUDDHA_CELLS 256
+#define BUDDHA_PROBES 4
+#define BUDDHA_DEAD_WEIGHT 16
+#define BUDDHA_BATCH 4096
+#define BUDDHA_PRESENT_MS 100
+_Atomic Uint32 *buddha_hist[MAX_THREADS];
+_Atomic Uint64 buddha_live[BUDDHA_CELLS*BUDDHA_CELLS];
+atomic_ullong buddha_samples;
+
+pthread_mutex_t view_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t view_changed = PTHREAD_COND_INITIALIZER;
+view published;
+
+//split view. the window grows to twice the width and the right half shows the julia set of the
+//point under the mouse on the left. the same workers draw it, but they always take a tile of
+//the preview before one of the main view, so it follows the mouse however busy they are.
+//a new preview only goes out once the last one is finished or PREVIEW_MS old, and its
+//iterations are capped, so a mouse that never stops still leaves time for the main view
+#define PREVIEW_MS 30
+#define PREVIEW_MAX_ITERATIONS 1000
+int split = 0;
+int hover_x = WIDTH/2, hover_y = HEIGHT/2;
+int preview_stale = 0;      //the mouse or the main view moved since the preview was published
+Uint32 preview_start;
+Uint32 preview_buf[WIDTH*HEIGHT];   //under frame_lock like framebuf
+mandel_view preview;                //under view_lock like published
+atomic_uint preview_gen;            //tags preview_next and preview_done like generation
+atomic_ullong preview_next;
+atomic_ullong preview_done;
+
+//frame time controller. while the user is moving around it picks the block size, and an
+//iteration cap if even 32x32 blocks are too slow, to hit target_ms. once input stops for
+//SETTLE_MS the view is redrawn at the quality the user asked for
+#define SETTLE_MS 150
+int auto_quality = 1;
+double target_ms = 16;
+double full_frame_ms = 0;   //running estimate of a full quality frame
+int live_compr = 1;         //what the workers are actually drawing with
+int live_iterations = 10;
+Uint32 frame_start;
+Uint32 last_frame_ms;
+int frame_timed = 1;
+
+//automatic iteration budget. a coarse grid of the view is probed past the current budget
+//and iterations is set to the smallest value that almost every escaping sample escapes by.
+//the probe runs on the ui thread, so it waits until input has settled for SETTLE_MS and
+//the budget stays put while the user is moving around. one call does at most PROBE_WORK
+//iterations over all its passes (a double-double one counts PROBE_DD_COST), a deep pass
+//thins the grid out to fit and a probe cut short never lowers the budget
+#define PROBE_GRID 32
+#define PROBE_WORK 4000000
+#define PROBE_DD_COST 8
+#define PROBE_MIN_SAMPLES 64
+#define MAX_AUTO_ITERATIONS 100000
+int auto_iterations = 0;
+
+//input recording and replay. -r file writes every input with its time since startup, -p file
+//plays one back in place of the keyboard and mouse and reports how long frames took.
+//-f plays each input as soon as the previous frame is finished instead of at its recorded
+//time, -n replays without a window
+enum input_type { INPUT_DRAG, INPUT_KEY, INPUT_QUIT, INPUT_HOVER };
+
+typedef struct {
+    Uint32 ms;
+    enum input_type type;
+    int a, b, c;            //drag: dx dy, key: sym mouse x y, hover: mouse x y
+} input;
+
+#define MAX_INPUTS 64       //per trip around the main loop
+FILE *record_file, *replay_file;
+int replay_fast = 0;
+input replay_next;
+int replay_left = 0;        //replay_next holds an input not played yet
+Uint32 *frame_times;        //ms from publish to the last tile of every finished frame
+size_t n_frame_times, frame_times_size;
+int frames_published = 0;
+
 //takes in x y in screen coordinates, y is adjusted for screen pitch inside.
 void setpixel(SDL_Surface *screen, int x, int y, Uint8 r, Uint8 g, Uint8 b)
 {
@@ -72,146 +211,869 @@ void put_pixel32( SDL_Surface *screen, int x, int y, Uint32 pixel )
     pixels[ ( y * screen->w ) + x ] = pixel;
 }
 
-//suite of stub functions for manipulating complex number structs
-comp add(comp a, comp b)
+
+//look up the saved orbit of whole screen pixel x y. escaped pixels never change, and a lower
+//cap is answered straight from what is stored, both return 1 with *vd filled in. otherwise
+//returns 0 with *c set, and o->z, o->depth are where iterating has to carry on from
+int orbit_lookup(const view *v, orbit *o, int x, int y, comp *c, value_depth *vd)
 {
-    return (comp){a.real+b.real, a.im+b.im};
+    comp z;
+
+    if (o->epoch != v->epoch)
+    {
+        orbit_start(&v->m, x, y, &o->z, c);
+        o->depth = 0;
+        o->escaped = 0;
+        o->epoch = v->epoch;
+        return 0;
+    }
+    if (o->escaped && o->depth < v->m.iterations)
+    {
+        *vd = (value_depth) {o->value, o->depth};
+        return 1;
+    }
+    if (o->escaped || o->depth >= v->m.iterations)
+    {
+        //the cap went down past this pixel, it counts as inside now. julia shades the inside
+        //by |z| at the cap which we no longer have, the deepest z we kept is close enough
+        *vd = (value_depth) {v->m.func == JULIA ? abs_im(o->z) : 0.0, v->m.iterations};
+        return 1;
+    }
+    orbit_start(&v->m, x, y, &z, c);
+    return 0;
 }
 
-comp mult(comp a, comp b)
-{ 
-    return (comp){a.real*b.real - a.im*b.im, a.real*b.im + a.im*b.real};
+//same as get_pixel for whole screen pixels, but picks up from the orbit saved last frame,
+//so pixels that hit the cap only run the extra iterations
+void get_pixel_resumed(const view *v, int x, int y, value_depth *vd)
+{
+    orbit *o = &orbits[y*WIDTH + x];
+    comp c;
+
+    //saved orbits are plain doubles, deep zooms always start over
+    if (v->m.precision == PREC_DOUBLE_DOUBLE)
+    {
+        get_pixel(&v->m, x, y, vd);
+        return;
+    }
+
+    if (orbit_lookup(v, o, x, y, &c, vd))
+        return;
+
+    *vd = iterate(v->m.func, &o->z, c, o->depth, v->m.iterations);
+    o->escaped = vd->depth < v->m.iterations;
+    o->value = vd->value;
+    o->depth = vd->depth;
 }
 
-double abs_im(comp a)
+//get_pixel_resumed for the n pixels xs on row y, in float eight at a time
+void get_pixels_float(const view *v, const int *xs, int n, int y, value_depth *out)
 {
-    return sqrtf(a.real * a.real + a.im * a.im);
+    v8f zr, zi, cr, ci;
+    v8i depth;
+    int lane_of[8];
+    int lanes = 0;
+    comp c;
+
+    for (int k = 0; k <= n; k++)
+    {
+        if (k < n)
+        {
+            orbit *o = &orbits[y*WIDTH + xs[k]];
+            if (orbit_lookup(v, o, xs[k], y, &c, &out[k]))
+                continue;
+
+            zr[lanes] = o->z.real;
+            zi[lanes] = o->z.im;
+            cr[lanes] = c.real;
+            ci[lanes] = c.im;
+            depth[lanes] = o->depth;
+            lane_of[lanes++] = k;
+            if (lanes < 8)
+                continue;
+        }
+        if (lanes == 0)
+            continue;
+
+        //spare lanes start out finished so they never run
+        for (int l = lanes; l < 8; l++)
+        {
+            zr[l] = zi[l] = cr[l] = ci[l] = 0;
+            depth[l] = v->m.iterations;
+        }
+
+        depth = iterate_v8(v->m.func, &zr, &zi, cr, ci, depth, v->m.iterations);
+
+        for (int l = 0; l < lanes; l++)
+        {
+            orbit *o = &orbits[y*WIDTH + xs[lane_of[l]]];
+            o->z = (comp) {zr[l], zi[l]};
+            o->depth = depth[l];
+            o->escaped = depth[l] < v->m.iterations;
+            o->value = o->escaped || v->m.func == JULIA ? abs_im(o->z) : 0.0;
+            out[lane_of[l]] = (value_depth) {o->value, o->depth};
+        }
+        lanes = 0;
+    }
 }
 
-double sqr(double x) 
+
+Uint32 shade(double v, int d, int iterations)
 {
-    return x*x;
+    rgb RGB = shade_rgb(v, d, iterations);
+    return SDL_MapRGB(pixel_format, RGB.r*256, RGB.g*256, RGB.b*256);
 }
 
-double cube(double x)
+//the mandelbrot set is its own conjugate as long as z starts on the real axis, and z^2+c julia
+//sets are the same turned 180 degrees since -z and z land on the same point. when the screen
+//center sits a whole number of pixels off the axis (or origin) the mirror of a pixel is
+//another pixel, so only one of the two gets iterated
+void find_symmetry(view *v)
 {
-    return x*x*x;
+    double mx = 2*v->m.zoom*v->m.center.real + 2*v->m.zoom*v->m.center_lo.real;
+    double my = 2*v->m.zoom*v->m.center.im + 2*v->m.zoom*v->m.center_lo.im;
+
+    //a mirror more than a screen away can not overlap, and would not fit in an int when deep
+    v->symmetry = NO_SYMMETRY;
+    if (fabs(mx) > 2*WIDTH || fabs(my) > 2*HEIGHT)
+        return;
+    if (fabs(my - round(my)) > 1e-6)
+        return;
+
+    if (v->m.func == MANDEL && v->m.julia_root.im == 0)
+        v->symmetry = CONJUGATE;
+    else if (v->m.func == JULIA && fabs(mx - round(mx)) <= 1e-6)
+        v->symmetry = ROTATE_180;
+
+    v->mirror_x = WIDTH + (int) round(mx);
+    v->mirror_y = HEIGHT + (int) round(my);
 }
 
-double sign(double x)
+//where pixel x y lands in the mirror image, 0 if it has none or it is off screen
+int mirror_pixel(const view *v, int x, int y, int *mx, int *my)
 {
-    if (x > 0)
+    if (v->symmetry == NO_SYMMETRY)
+        return 0;
+    *mx = v->symmetry == ROTATE_180 ? v->mirror_x - x : x;
+    *my = v->mirror_y - y;
+    return *mx >= 0 && *mx < WIDTH && *my >= 0 && *my < HEIGHT;
+}
+
+//1 if this pixel has to be iterated, 0 if it is a copy of an earlier one
+int unique_pixel(const view *v, int x, int y)
+{
+    int mx, my;
+    if (!mirror_pixel(v, x, y, &mx, &my))
         return 1;
-    return -1;
+    return y < my || (y == my && x <= mx);
+}
+
+//1 if render_tile has to work out pixel x y. a compressed block is copied from its corner, and
+//where the mirror image runs off the screen edge the pixels past it are unique again while
+//their corner can still be a copy, so with blocks every corner gets worked out
+int drawn_pixel(const view *v, int x, int y)
+{
+    int cl = v->compr_level;
+    return unique_pixel(v, x, y) || (cl > 1 && x % cl == 0 && y % cl == 0);
+}
+
+//take the next unit from a generation tagged counter, fails once the generation moved on
+//or the counter reached limit
+int claim(atomic_ullong *counter, unsigned gen, int limit, int *out)
+{
+    unsigned long long cur = atomic_load(counter);
+    for (;;)
+    {
+        if ((unsigned) (cur >> 32) != gen || (int) (cur & 0xffffffff) >= limit)
+            return 0;
+        if (atomic_compare_exchange_weak(counter, &cur, cur + 1))
+        {
+            *out = cur & 0xffffffff;
+            return 1;
+        }
+    }
+}
+
+// =======================================================
+// most of the work is done here, get each pixel of a tile and draw it.
+// returns 0 if the view changed underneath us and the tile was thrown away
+// ======================================================
+int render_tile(const view *vw, int tile, unsigned gen)
+{
+    Uint32 px[TILE*TILE];
+    int x0 = (tile % TILES_X) * TILE;
+    int y0 = (tile / TILES_X) * TILE;
+    int w = WIDTH - x0 < TILE ? WIDTH - x0 : TILE;
+    int h = HEIGHT - y0 < TILE ? HEIGHT - y0 : TILE;
+    int cl = vw->compr_level;
+
+    double v;
+    int d;
+    value_depth vd;
+
+    //float views do a row's pixels in one batch up front so they can go eight at a time
+    int batched = vw->m.precision == PREC_FLOAT && !vw->m.smoothing;
+    int xs[TILE];
+    value_depth row[TILE];
+
+    pthread_mutex_lock(&tile_locks[tile]);
+    for (int ty = 0; ty < h; ty++)
+    {
+        //bail out as soon as the user has moved on, checked once a row so drags stay snappy
+        if (atomic_load(&generation) != gen)
+        {
+            pthread_mutex_unlock(&tile_locks[tile]);
+            return 0;
+        }
+
+        int y = y0 + ty;
+        int n = 0;
+        if (batched && y % cl == 0)
+        {
+            for (int x = x0; x < x0 + w; x += cl - x % cl)
+                if (drawn_pixel(vw, x, y))
+                    xs[n++] = x;
+            get_pixels_float(vw, xs, n, y, row);
+            n = 0;
+        }
+
+        for (int tx = 0; tx < w; tx++)
+        {
+            int x = x0 + tx;
+            v = 0.0;
+            d = 0;
+            //drawn by whoever owns its mirror image
+            if (!drawn_pixel(vw, x, y))
+                continue;
+            //if in fast mode and not in a corner pixel
+            else if (!(x % cl == 0 && y % cl == 0))
+            {
+                //just copy and paste top corner pixel
+                px[ty*TILE + tx] = px[(ty - y%cl)*TILE + tx - x%cl];
+            }
+            else 
+            {
+                if (vw->m.smoothing)
+                {
+                    get_pixel_smoothed(&vw->m, x, y, &vd);
+                    v = vd.value; d = vd.depth;
+                }
+                else if (batched)
+                {
+                    v = row[n].value; d = row[n].depth;
+                    n++;
+                }
+                else    
+                {
+                    get_pixel_resumed(vw, x, y, &vd);
+                    v = vd.value; d = vd.depth;
+                }
+
+                px[ty*TILE + tx] = shade(v, d, vw->m.iterations);
+            }
+        }
+    }
+    pthread_mutex_unlock(&tile_locks[tile]);
+
+    pthread_mutex_lock(&frame_lock);
+    if (atomic_load(&generation) == gen && vw->symmetry == NO_SYMMETRY)
+        for (int ty = 0; ty < h; ty++)
+            memcpy(&framebuf[(y0 + ty)*WIDTH + x0], &px[ty*TILE], w*sizeof(Uint32));
+    else if (atomic_load(&generation) == gen)
+        for (int ty = 0; ty < h; ty++)
+            for (int tx = 0; tx < w; tx++)
+            {
+                int x = x0 + tx, y = y0 + ty, mx, my;
+                if (!unique_pixel(vw, x, y))
+                    continue;
+                framebuf[y*WIDTH + x] = px[ty*TILE + tx];
+                if (mirror_pixel(vw, x, y, &mx, &my))
+                    framebuf[my*WIDTH + mx] = px[ty*TILE + tx];
+            }
+    pthread_mutex_unlock(&frame_lock);
+    return atomic_load(&generation) == gen;
+}
+
+// ===================================
+// julia atlas
+// ===================================
+//the screen is cut into ATLAS_THUMB pixel squares and each one shows the julia set of the
+//point of the view at its center, drawn over ATLAS_SPAN of the z plane. thumbnails are done
+//in groups of eight with one thumbnail per vector lane, so lanes differ in julia_root and
+//run the same pixel, and threads claim groups like tiles
+#define ATLAS_THUMB 25
+#define ATLAS_COLS (WIDTH / ATLAS_THUMB)
+#define ATLAS_ROWS (HEIGHT / ATLAS_THUMB)
+#define ATLAS_GROUPS ((ATLAS_COLS*ATLAS_ROWS + 7) / 8)
+#define ATLAS_SPAN 4.0
+
+//units of work in a frame, what tiles_done counts up to
+int frame_units(const view *v)
+{
+    return v->atlas ? ATLAS_GROUPS : TILES_X*TILES_Y;
+}
+
+//julia_root of the thumbnail under screen pixel x y
+comp atlas_root(const view *v, int x, int y)
+{
+    int col = x / ATLAS_THUMB, row = y / ATLAS_THUMB;
+    return px_to_math(&v->m, col*ATLAS_THUMB + ATLAS_THUMB/2, row*ATLAS_THUMB + ATLAS_THUMB/2);
+}
+
+int render_atlas_group(const view *vw, int group, unsigned gen)
+{
+    static const int n_thumbs = ATLAS_COLS*ATLAS_ROWS;
+    Uint32 px[8][ATLAS_THUMB*ATLAS_THUMB];
+    enum function f = vw->m.func == JULIA_3 ? JULIA_3 : JULIA;
+    double step = ATLAS_SPAN / (ATLAS_THUMB - 1);
+    v8f cr, ci;
+    int lanes = 0;
+
+    for (int l = 0; l < 8; l++)
+    {
+        int t = group*8 + l;
+        comp root = {0, 0};
+        if (t < n_thumbs)
+        {
+            root = atlas_root(vw, (t % ATLAS_COLS) * ATLAS_THUMB, (t / ATLAS_COLS) * ATLAS_THUMB);
+            lanes++;
+        }
+        cr[l] = root.real;
+        ci[l] = root.im;
+    }
+
+    //the last row and column of each thumbnail stay dark as a border
+    for (int y = 0; y < ATLAS_THUMB; y++)
+    {
+        if (atomic_load(&generation) != gen)
+            return 0;
+        for (int x = 0; x < ATLAS_THUMB; x++)
+        {
+            if (x == ATLAS_THUMB - 1 || y == ATLAS_THUMB - 1)
+            {
+                for (int l = 0; l < lanes; l++)
+                    px[l][y*ATLAS_THUMB + x] = 0;
+                continue;
+            }
+
+            v8f zr = (v8f) {0} + (float) ((x - ATLAS_THUMB/2) * step);
+            v8f zi = (v8f) {0} + (float) (-(y - ATLAS_THUMB/2) * step);
+            v8i depth = (v8i) {0};
+            for (int l = lanes; l < 8; l++)
+                depth[l] = vw->m.iterations;
+
+            depth = iterate_v8(f, &zr, &zi, cr, ci, depth, vw->m.iterations);
+            for (int l = 0; l < lanes; l++)
+            {
+                comp z = {zr[l], zi[l]};
+                double value = depth[l] < vw->m.iterations || f == JULIA ? abs_im(z) : 0.0;
+                px[l][y*ATLAS_THUMB + x] = shade(value, depth[l], vw->m.iterations);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&frame_lock);
+    if (atomic_load(&generation) == gen)
+        for (int l = 0; l < lanes; l++)
+        {
+            int t = group*8 + l;
+            int x0 = (t % ATLAS_COLS) * ATLAS_THUMB, y0 = (t / ATLAS_COLS) * ATLAS_THUMB;
+            for (int y = 0; y < ATLAS_THUMB; y++)
+                memcpy(&framebuf[(y0 + y)*WIDTH + x0], &px[l][y*ATLAS_THUMB], ATLAS_THUMB*sizeof(Uint32));
+        }
+    pthread_mutex_unlock(&frame_lock);
+    return atomic_load(&generation) == gen;
 }
 
 // ===================================
-// all of the fractal functions go here
+// julia preview of the split view
 // ===================================
-value_depth sinking_ship(comp c, int iterations)
+//1 while the preview has tiles nobody has claimed yet. generation 0 is before the first
+//publish_preview, there is nothing to draw then
+int preview_waiting(void)
+{
+    unsigned long long next = atomic_load(&preview_next);
+    unsigned gen = atomic_load(&preview_gen);
+    return gen != 0 && (unsigned) (next >> 32) == gen && (int) (next & 0xffffffff) < TILES_X*TILES_Y;
+}
+
+int preview_finished(void)
+{
+    unsigned long long done = atomic_load(&preview_done);
+    return (unsigned) (done >> 32) != atomic_load(&preview_gen) || (int) (done & 0xffffffff) >= TILES_X*TILES_Y;
+}
+
+//no saved orbits or symmetry here, every preview is a new julia set
+int render_preview_tile(const mandel_view *pv, int tile, unsigned gen)
+{
+    value_depth vd[TILE*TILE];
+    Uint32 px[TILE*TILE];
+    int x0 = (tile % TILES_X) * TILE;
+    int y0 = (tile / TILES_X) * TILE;
+    int w = WIDTH - x0 < TILE ? WIDTH - x0 : TILE;
+    int h = HEIGHT - y0 < TILE ? HEIGHT - y0 : TILE;
+
+    mandel_render(pv, x0, y0, w, h, vd, TILE);
+    for (int ty = 0; ty < h; ty++)
+        for (int tx = 0; tx < w; tx++)
+            px[ty*TILE + tx] = shade(vd[ty*TILE + tx].value, vd[ty*TILE + tx].depth, pv->iterations);
+
+    pthread_mutex_lock(&frame_lock);
+    if (atomic_load(&preview_gen) == gen)
+        for (int ty = 0; ty < h; ty++)
+            memcpy(&preview_buf[(y0 + ty)*WIDTH + x0], &px[ty*TILE], w*sizeof(Uint32));
+    pthread_mutex_unlock(&frame_lock);
+    return atomic_load(&preview_gen) == gen;
+}
+
+//draw preview tiles for as long as there are any. workers call this between every unit of
+//work on the main view
+void render_preview(void)
+{
+    int tile, done;
+    if (!preview_waiting())
+        return;
+
+    pthread_mutex_lock(&view_lock);
+    unsigned gen = atomic_load(&preview_gen);
+    mandel_view pv = preview;
+    pthread_mutex_unlock(&view_lock);
+
+    while (claim(&preview_next, gen, TILES_X*TILES_Y, &tile) && render_preview_tile(&pv, tile, gen))
+    {
+        claim(&preview_done, gen, TILES_X*TILES_Y, &done);
+        atomic_store(&dirty, 1);
+    }
+}
+
+//cheap per thread random numbers, xorshift64*
+static inline Uint64 next_random(Uint64 *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static inline double random_unit(Uint64 *state)
 {
-    comp z = julia_root;
-    for (int i=0; i<iterations; i++)
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//run c through mandel and, if it escapes, add every point of its orbit that lands on screen
+//to hist weight times. returns how many points landed
+int buddha_splat(const view *v, comp c, _Atomic Uint32 *hist, Uint32 weight)
+{
+    comp z = v->m.julia_root;
+    value_depth vd = mandel(&z, c, 0, v->m.iterations);
+    int landed = 0;
+
+    if (vd.depth >= v->m.iterations)
+        return 0;
+
+    //second time round, now we know the orbit is worth drawing
+    z = v->m.julia_root;
+    for (int i = 0; i <= vd.depth; i++)
     {
-        z.real = fabs(z.real);
-        z.im = fabs(z.im);
         z = add(mult(z, z), c);
-        if (abs_im(z) > 2)
-            return (value_depth) {abs_im(z), i};
+        //floor, not truncation, or everything from -1 to 1 piles up in row and column 0
+        double fx = floor((z.real + v->m.center.real) * v->m.zoom + WIDTH/2);
+        double fy = floor(HEIGHT/2 + (v->m.center.im - z.im) * v->m.zoom);
+        if (fx < 0 || fx >= WIDTH || fy < 0 || fy >= HEIGHT)
+            continue;
+        int i = (int) fy * WIDTH + (int) fx;
+        //only this thread writes its histogram, relaxed load and store is a plain add.
+        //a pixel that has been hit four billion times is as bright as it gets, it stays there
+        Uint32 n = atomic_load_explicit(&hist[i], memory_order_relaxed);
+        atomic_store_explicit(&hist[i], n < UINT32_MAX - weight ? n + weight : UINT32_MAX,
+                              memory_order_relaxed);
+        landed++;
     }
-    return (value_depth) {0.0, iterations};
+    return landed;
 }
 
-value_depth julia(comp c, int iterations)
+static inline comp buddha_cell_point(int cell, Uint64 *rng)
 {
-    comp z = c;
-    for (int i=0; i<iterations; i++)
+    double size = 4.0 / BUDDHA_CELLS;
+    return (comp) {-2 + (cell % BUDDHA_CELLS + random_unit(rng)) * size,
+                   -2 + (cell / BUDDHA_CELLS + random_unit(rng)) * size};
+}
+
+//record whether cell is live for generation gen, unless a worker on a newer view got there first
+static void buddha_mark(int cell, unsigned gen, int hit)
+{
+    Uint64 old = atomic_load(&buddha_live[cell]);
+    while ((int) (gen - (unsigned) (old >> 1)) >= 0
+           && !atomic_compare_exchange_weak(&buddha_live[cell], &old, (Uint64) gen << 1 | hit))
+        ;
+}
+
+//probe rows of cells handed out through next_tile, then sample until the view changes
+void buddha_worker(const view *v, int id, unsigned gen)
+{
+    static _Atomic Uint32 scratch[WIDTH*HEIGHT];
+    Uint64 rng = 0x9E3779B97F4A7C15ULL * (id + 1) ^ gen;
+    Uint64 live = (Uint64) gen << 1 | 1;
+    int row, done;
+
+    if (!buddha_hist[id])
+        buddha_hist[id] = calloc(WIDTH*HEIGHT, sizeof(Uint32));
+    for (int i = 0; i < WIDTH*HEIGHT; i++)
+        atomic_store_explicit(&buddha_hist[id][i], 0, memory_order_relaxed);
+
+    //probe splats go into a throwaway histogram, only whether anything landed matters
+    while (claim(&next_tile, gen, BUDDHA_CELLS, &row))
     {
-        
-        z = add(mult(z, z), julia_root);
-        if (abs_im(z) > 2)
-            return (value_depth) {abs_im(z), i};
+        for (int cell = row*BUDDHA_CELLS; cell < (row + 1)*BUDDHA_CELLS; cell++)
+        {
+            int hit = 0;
+            for (int p = 0; p < BUDDHA_PROBES && !hit; p++)
+                hit = buddha_splat(v, buddha_cell_point(cell, &rng), scratch, 1) > 0;
+            buddha_mark(cell, gen, hit);
+        }
+        claim(&tiles_done, gen, BUDDHA_CELLS, &done);
+    }
+
+    while (atomic_load(&generation) == gen)
+    {
+        render_preview();
+        for (int i = 0; i < BUDDHA_BATCH;)
+        {
+            Uint64 r = next_random(&rng);
+            int cell = r % (BUDDHA_CELLS*BUDDHA_CELLS);
+            Uint32 weight = 1;
+            if (atomic_load_explicit(&buddha_live[cell], memory_order_relaxed) != live)
+            {
+                if (r >> 32 & (BUDDHA_DEAD_WEIGHT - 1))
+                    continue;
+                weight = BUDDHA_DEAD_WEIGHT;
+            }
+            buddha_splat(v, buddha_cell_point(cell, &rng), buddha_hist[id], weight);
+            i++;
+        }
+        atomic_fetch_add(&buddha_samples, BUDDHA_BATCH);
     }
-    return (value_depth) {abs_im(z), iterations};
 }
 
-value_depth mandel_3(comp c, int iterations)
+//sum the worker histograms and tone map them into framebuf
+void buddha_draw(void)
 {
-    comp z = c;
-    for (int i=0; i<iterations; i++)
+    static Uint64 sum[WIDTH*HEIGHT];      //workers times UINT32_MAX doesn't fit 32 bits
+    Uint64 max = 1;
+
+    memset(sum, 0, sizeof(sum));
+    for (int t = 0; t < n_workers; t++)
+    {
+        if (!buddha_hist[t])
+            continue;
+        for (int i = 0; i < WIDTH*HEIGHT; i++)
+            sum[i] += atomic_load_explicit(&buddha_hist[t][i], memory_order_relaxed);
+    }
+    for (int i = 0; i < WIDTH*HEIGHT; i++)
+        if (sum[i] > max)
+            max = sum[i];
+
+    pthread_mutex_lock(&frame_lock);
+    for (int i = 0; i < WIDTH*HEIGHT; i++)
     {
-        z = add(mult(z, mult(z, z)), julia_root);
-        if (abs_im(z) > 2)
-            return (value_depth) {abs_im(z), i};
+        double t = sqrt((double) sum[i] / max);
+        hsv HSV = {300 - 300*t, 0.9 - 0.9*t, t};
+        rgb RGB = hsv2rgb(HSV);
+        framebuf[i] = SDL_MapRGB(pixel_format, RGB.r*255, RGB.g*255, RGB.b*255);
     }
-    return (value_depth) {0.0, iterations};
+    pthread_mutex_unlock(&frame_lock);
+    atomic_store(&dirty, 1);
 }
 
-value_depth mandel(comp c, int iterations)
+//each worker waits for a new view, then keeps claiming tiles until the frame is done or stale
+void *render_worker(void *arg)
 {
-    comp z = julia_root;
-    for (int i=0; i<iterations; i++)
+    int id = (intptr_t) arg;
+    unsigned seen = 0;
+    int tile, done;
+
+    for (;;)
     {
-        z = add(mult(z, z), c);
-        if (abs_im(z) > 2)
-            return (value_depth) {abs_im(z), i};
+        pthread_mutex_lock(&view_lock);
+        while (atomic_load(&generation) == seen && !preview_waiting())
+            pthread_cond_wait(&view_changed, &view_lock);
+        int fresh = atomic_load(&generation) != seen;
+        seen = atomic_load(&generation);
+        view vw = published;
+        pthread_mutex_unlock(&view_lock);
+
+        //the preview goes first, and again after every tile of the main view
+        render_preview();
+        if (!fresh)
+            continue;
+
+        if (vw.buddha)
+        {
+            buddha_worker(&vw, id, seen);
+            continue;
+        }
+
+        while (claim(&next_tile, seen, frame_units(&vw), &tile))
+        {
+            if (!(vw.atlas ? render_atlas_group(&vw, tile, seen) : render_tile(&vw, tile, seen)))
+                break;
+            claim(&tiles_done, seen, frame_units(&vw), &done);
+            atomic_store(&dirty, 1);
+            render_preview();
+        }
+    }
+    return NULL;
+}
+
+//move a coordinate kept as hi + lo by d without dropping the bits below hi
+void pan(double *hi, double *lo, double d)
+{
+    dd s = dd_add((dd) {*hi, *lo}, (dd) {d, 0});
+    *hi = s.hi;
+    *lo = s.lo;
+}
+
+view current_view(void)
+{
+    return (view) {.m = {.func = func, .julia_root = julia_root, .center = center, .center_lo = center_lo,
+                         .zoom = zoom, .iterations = iterations, .smoothing = smoothing,
+                         .width = WIDTH, .height = HEIGHT},
+                   .compr_level = compr_level, .buddha = buddha, .atlas = atlas};
+}
+
+//hand the current globals to the workers, anything they were doing is now stale
+void publish_view(void)
+{
+    //only this thread ever writes published, so reading it without the lock is fine
+    static unsigned checked_epoch;
+    static int checked_iterations, float_ok;
+    view prev = published;
+    view next = current_view();
+
+    next.m.iterations = live_iterations;
+    next.compr_level = live_compr;
+    next.epoch = prev.epoch;
+    if (prev.m.func != next.m.func || prev.m.zoom != next.m.zoom
+            || prev.m.center.real != next.m.center.real || prev.m.center.im != next.m.center.im
+            || prev.m.center_lo.real != next.m.center_lo.real || prev.m.center_lo.im != next.m.center_lo.im
+            || prev.m.julia_root.real != next.m.julia_root.real || prev.m.julia_root.im != next.m.julia_root.im)
+        next.epoch++;
+    find_symmetry(&next);
+    choose_precision(&next.m);
+
+    //the float check iterates a few hundred pixels twice, so only redo it when something changed
+    if (next.m.precision == PREC_FLOAT)
+    {
+        if (next.epoch != checked_epoch || next.m.iterations != checked_iterations)
+        {
+            float_ok = float_agrees(&next.m);
+            checked_epoch = next.epoch;
+            checked_iterations = next.m.iterations;
+        }
+        if (!float_ok)
+            next.m.precision = PREC_DOUBLE;
     }
-    return (value_depth) {0.0, iterations};
+
+    //saved orbits from another precision are not worth resuming from
+    if (next.m.precision != prev.m.precision)
+        next.epoch++;
+
+    pthread_mutex_lock(&view_lock);
+    published = next;
+    unsigned gen = atomic_load(&generation) + 1;
+    if (gen == 0)
+        gen = 1;
+    atomic_store(&next_tile, (unsigned long long) gen << 32);
+    atomic_store(&tiles_done, (unsigned long long) gen << 32);
+    atomic_store(&generation, gen);
+    pthread_cond_broadcast(&view_changed);
+    pthread_mutex_unlock(&view_lock);
+
+    frame_start = SDL_GetTicks();
+    frame_timed = 0;
+}
+
+//the julia_root the preview shows for screen pixel x y, over an atlas the thumbnail's own
+comp preview_root(int x, int y)
+{
+    view v = current_view();
+    return v.atlas ? atlas_root(&v, x, y) : px_to_math(&v.m, x, y);
+}
+
+//point the workers at the julia set of the point under the mouse, framed like an atlas thumbnail
+void publish_preview(void)
+{
+    int its = iterations < PREVIEW_MAX_ITERATIONS ? iterations : PREVIEW_MAX_ITERATIONS;
+    mandel_view pv = {.func = JULIA, .julia_root = preview_root(hover_x, hover_y),
+                      .zoom = WIDTH / ATLAS_SPAN, .iterations = its, .width = WIDTH, .height = HEIGHT};
+    mandel_prepare(&pv, 1);
+
+    pthread_mutex_lock(&view_lock);
+    preview = pv;
+    unsigned gen = atomic_load(&preview_gen) + 1;
+    if (gen == 0)
+        gen = 1;
+    atomic_store(&preview_next, (unsigned long long) gen << 32);
+    atomic_store(&preview_done, (unsigned long long) gen << 32);
+    atomic_store(&preview_gen, gen);
+    pthread_cond_broadcast(&view_changed);
+    pthread_mutex_unlock(&view_lock);
+
+    preview_start = SDL_GetTicks();
+    preview_stale = 0;
 }
 
-//convert from screen pixels to coordinates in the imaginary plane
-comp px_to_math(double x, double y)
+int cmp_int(const void *a, const void *b)
 {
-    return (comp) {(x - (WIDTH/2)) / zoom - center.real, 
-                          -((y - (HEIGHT/2)) / zoom - center.im)};
+    return *(const int*) a - *(const int*) b;
 }
 
-//get values for pixel at x y. not to be confused with get_pixel32 which retrieves prev written pixels
-void get_pixel(double x, double y, value_depth *vd)
+//pick an iteration budget for the current view from a probe of up to PROBE_GRID^2 samples
+int probe_iterations(void)
 {
-    comp c = px_to_math(x, y);
-    switch (func)
+    static int depths[PROBE_GRID*PROBE_GRID];
+    view v = current_view();
+    choose_precision(&v.m);
+    value_depth vd;
+    int escaped = 0, cut_short = 0;
+    long long work = PROBE_WORK / (v.m.precision == PREC_DOUBLE_DOUBLE ? PROBE_DD_COST : 1);
+    int budget = iterations*4 < 64 ? 64 : iterations*4;
+
+    //at most two widenings per call, a deep zoom converges over a few settles instead of stalling one
+    for (int tries = 0; tries < 3; tries++)
     {
-        case MANDEL://mandel
-            c.real -=  sqr(julia_root.real) - sqr(julia_root.im);
-            c.im -= 2*(julia_root.real*julia_root.im);
-            *vd = mandel(c, iterations);
-            break;
+        if (budget > MAX_AUTO_ITERATIONS)
+            budget = MAX_AUTO_ITERATIONS;
+        if (budget > work / PROBE_MIN_SAMPLES)
+        {
+            //not even a thin grid fits at this depth, what the last pass saw has to do
+            cut_short = 1;
+            if (tries > 0)
+                break;
+            budget = work / PROBE_MIN_SAMPLES;
+        }
+        int samples = work / budget < PROBE_GRID*PROBE_GRID ? work / budget : PROBE_GRID*PROBE_GRID;
+        cut_short |= samples < PROBE_GRID*PROBE_GRID;
+        work -= (long long) samples * budget;
+        v.m.iterations = budget;
+        escaped = 0;
+        int late = 0;
+
+        //samples spread evenly over the grid
+        for (int k = 0; k < samples; k++)
+        {
+            int g = k * (PROBE_GRID*PROBE_GRID) / samples;
+            get_pixel(&v.m, (g % PROBE_GRID + 0.5) * WIDTH / PROBE_GRID,
+                      (g / PROBE_GRID + 0.5) * HEIGHT / PROBE_GRID, &vd);
+            if (vd.depth >= budget)
+                continue;
+            depths[escaped++] = vd.depth;
+            if (vd.depth >= budget/2)
+                late++;
+        }
 
-        case JULIA://julia
-            *vd = julia(c, iterations);
+        //nothing escaped yet, or plenty of pixels still escaping just under the cap,
+        //the boundary goes deeper than we looked
+        if ((escaped > 0 && late*100 <= escaped) || budget == MAX_AUTO_ITERATIONS)
+        {
+            cut_short = 0;
             break;
+        }
+        budget *= 4;
+    }
 
-        case JULIA_3://z^3+c
-            *vd = mandel_3(c, iterations);
-            break;
+    //everything is inside the set (or needs far more than we can probe), leave it alone
+    if (escaped == 0)
+        return iterations;
+
+    qsort(depths, escaped, sizeof(int), cmp_int);
+    int n = depths[escaped*995/1000] + 1;
+    n += n/4;
+    if (n < 10)
+        n = 10;
+    if (cut_short && n < iterations)
+        n = iterations;
+    return n > MAX_AUTO_ITERATIONS ? MAX_AUTO_ITERATIONS : n;
+}
 
-        case SINKING_SHIP://sinking ship
-            c.real -=  fabs(sqr(julia_root.real) - sqr(julia_root.im));
-            c.im -= fabs(2*(julia_root.real*julia_root.im));
-            *vd = sinking_ship(c, iterations);
-            break;
+//set live_compr and live_iterations for the next frame
+void choose_quality(int interacting)
+{
+    live_compr = compr_level;
+    live_iterations = iterations;
+    if (!auto_quality || !interacting || full_frame_ms <= 0 || buddha || atlas)
+        return;
+
+    //a frame costs roughly one block size squared less than a full one
+    while (live_compr < 32 && full_frame_ms / sqr(live_compr) > target_ms)
+        live_compr *= 2;
+
+    double cost = full_frame_ms / sqr(live_compr);
+    if (cost > target_ms)
+    {
+        live_iterations = iterations * target_ms / cost;
+        if (live_iterations < 10)
+            live_iterations = 10;
+        if (live_iterations > iterations)
+            live_iterations = iterations;
     }
 }
 
-//funtion for choosing which value to keep for mulitple depth readings
-int zero_or_max(running, new)
+//once every tile of the current view is in, fold its time into the full frame estimate
+void time_frame(void)
 {
-    if (new ==0)
-        return 0;
-    if (new > running)
-        return new;
-    return running;
+    //a buddhabrot never finishes, and its probe pass says nothing about tile cost
+    if (frame_timed || published.buddha)
+        return;
+
+    unsigned long long done = atomic_load(&tiles_done);
+    if ((unsigned) (done >> 32) != atomic_load(&generation) || (int) (done & 0xffffffff) < frame_units(&published))
+        return;
+
+    frame_timed = 1;
+    last_frame_ms = SDL_GetTicks() - frame_start;
+    if (!published.atlas)
+    {
+        double full = (double) last_frame_ms * sqr(live_compr) * iterations / live_iterations;
+        full_frame_ms = full_frame_ms > 0 ? 0.5*full_frame_ms + 0.5*full : full;
+    }
+
+    if (replay_file)
+    {
+        if (n_frame_times == frame_times_size)
+        {
+            frame_times_size = frame_times_size ? 2*frame_times_size : 1024;
+            frame_times = realloc(frame_times, frame_times_size * sizeof(*frame_times));
+        }
+        frame_times[n_frame_times++] = last_frame_ms;
+    }
 }
 
-// =======================================================
-// most of the work is done here, get each pixel and draw it.
-// ======================================================
-void DrawScreen(SDL_Surface* screen, int h)
+void start_workers(void)
 {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    if (n > MAX_THREADS)
+        n = MAX_THREADS;
+
+    for (int i = 0; i < TILES_X*TILES_Y; i++)
+        pthread_mutex_init(&tile_locks[i], NULL);
 
-    int x, y;
-    Uint32 val;
+    n_workers = n;
+    for (int i = 0; i < n; i++)
+    {
+        pthread_t t;
+        pthread_create(&t, NULL, render_worker, (void *) (intptr_t) i);
+        pthread_detach(t);
+    }
+}
+
+//copy whatever tiles are finished onto the screen, old tiles stay until they are replaced
+void present(SDL_Surface* screen)
+{
+    if (!atomic_exchange(&dirty, 0))
+        return;
 
     //conditionally perform locking before accessing pixels
     //return if failed to lock
@@ -219,111 +1081,627 @@ void DrawScreen(SDL_Surface* screen, int h)
         if (SDL_LockSurface(screen) <0)
             return;
 
-    //printf("%.3f %.3f\n", julia_root.real, julia_root.im);
+    pthread_mutex_lock(&frame_lock);
+    for (int y = 0; y < HEIGHT; y++)
+        memcpy((Uint8*) screen->pixels + y*screen->pitch, &framebuf[y*WIDTH], WIDTH*BPP);
+    if (screen->w >= 2*WIDTH)
+        for (int y = 0; y < HEIGHT; y++)
+            memcpy((Uint8*) screen->pixels + y*screen->pitch + WIDTH*BPP, &preview_buf[y*WIDTH], WIDTH*BPP);
+    pthread_mutex_unlock(&frame_lock);
+
+    if (SDL_MUSTLOCK(screen)) 
+        SDL_UnlockSurface(screen);
+
+    SDL_Flip(screen);
+}
+
+void print_data(void)
+{
     
-    double v, color;
-    int d;
-    value_depth vd;
+    printf("Iterations: %d (auto %d)\n", iterations, auto_iterations);
+    printf("Julia value: %f, %f\n", julia_root.real, julia_root.im);
+    printf("Center: %.17g%+.17g, %.17g%+.17g\n", center.real, center_lo.real, center.im, center_lo.im);
+    printf("Zoom: %g (%s)\n", zoom, (char *[]) {"double", "double-double", "float"}[published.m.precision]);
+    printf("Smoothing: %d\n", smoothing);
+    printf("Compression Level: %d\n", compr_level);
+    printf("Auto quality: %d (target %.0f ms)\n", auto_quality, target_ms);
+    printf("Drawing at: block %d, %d iterations\n", live_compr, live_iterations);
+    printf("Last frame: %u ms, full frame estimate %.1f ms\n", last_frame_ms, full_frame_ms);
+    printf("Buddhabrot: %d\n", buddha);
+    printf("Julia atlas: %d\n", atlas);
+    printf("Split view: %d\n", split);
+    printf("\n");
+}
+
+
+//headless mode for coordinator.c, answers tile requests from stdin on stdout until eof.
+//one request at a time, run one of these per core
+int tile_worker(void)
+{
+    uint8_t req[TILE_REQUEST_SIZE];
+    tile_request rq;
+    uint8_t *resp = NULL;
+    value_depth *pixels = NULL;
+    size_t resp_size = 0;
 
-    for (y = 0; y <screen->h; y++)
+    while (read_full(0, req, sizeof(req)))
     {
-        for(x = 0; x < screen->w; x++)
+        if (!decode_request(req, &rq))
         {
-            v = 0.0;
-            d = 0;
-            //if in fast mode and not in a corner pixel
-            if (!(x % compr_level == 0 && y % compr_level == 0))
+            fprintf(stderr, "tile worker: bad request\n");
+            return 1;
+        }
+
+        mandel_view v = request_view(&rq);
+        mandel_prepare(&v, 0);
+
+        size_t need = TILE_RESPONSE_HEADER + (size_t) rq.w*rq.h*TILE_PIXEL_SIZE;
+        if (need > resp_size)
+        {
+            free(resp);
+            free(pixels);
+            resp = malloc(need);
+            pixels = malloc((size_t) rq.w*rq.h*sizeof(value_depth));
+            resp_size = need;
+            if (!resp || !pixels)
             {
-                //just copy and paste top corner pixel
-                put_pixel32(screen, x, y,
-                        get_pixel32(screen, x-(x%compr_level), y-(y%compr_level)));
+                fprintf(stderr, "tile worker: out of memory\n");
+                return 1;
             }
-            else 
-            {
-                if (smoothing)
-                {
-                    //get x y in a complex number and adjust for the drift
-                    //aka move to center the origin as the so-called "julia number" changes
-                    get_pixel((double) x+0.25, (double) y+0.25, &vd);
-                    v += vd.value; 
-                    d = zero_or_max(d, vd.depth);
-
-                    get_pixel((double) x-0.25, (double) y+0.25, &vd);
-                    v += vd.value; 
-                    d = zero_or_max(d, vd.depth);
-
-                    get_pixel((double) x-0.25, (double) y-0.25, &vd);
-                    v += vd.value; 
-                    d = zero_or_max(d, vd.depth);
-                    
-                    get_pixel((double) x+0.25, (double) y-0.25, &vd);
-                    v += vd.value; 
-                    d = zero_or_max(d, vd.depth);
-
-                    v /= 4;
+        }
+        mandel_render(&v, rq.x0, rq.y0, rq.w, rq.h, pixels, rq.w);
+
+        uint8_t *p = resp;
+        put_u32(&p, TILE_MAGIC);
+        put_u32(&p, rq.id);
+        put_u32(&p, rq.w);
+        put_u32(&p, rq.h);
+        for (int i = 0; i < rq.w*rq.h; i++)
+        {
+            put_f64(&p, pixels[i].value);
+            put_u32(&p, pixels[i].depth);
+        }
 
-                }
-                else    
-                {
-                    get_pixel((double) x, (double) y, &vd);
-                    v = vd.value; d = vd.depth;
-                }
+        if (!write_full(1, resp, need))
+            return 1;
+    }
+    free(resp);
+    free(pixels);
+    return 0;
+}
 
-                color = 300 - 300*((double) d/iterations);
-                //((.5*(v-1.5)) / (1+.5*(v-1.5))) * 100 + 00;
+// ===================================
+// exponential map zoom videos
+// ===================================
+//every frame of a zoom into one point is a disc of the same picture at another scale, so
+//instead of rendering each frame the picture is rendered once in log-polar coordinates:
+//row k of the strip is the circle of radius r_min*e^(k*step) around the center, sampled at
+//strip_width angles, with step = 2pi/strip_width so samples are square. a frame is then just
+//a lookup of every pixel's log radius and angle in the strip
+typedef struct {
+    mandel_view base;
+    int strip_width, strip_rows;
+    double r_min, step;
+    Uint8 *strip;           //rgb, strip_rows x strip_width
+    double zoom_from, zoom_to;
+    int frames;
+    const char *prefix;
+    int n_threads;
+} zoom_job;
 
-             
-                //convert to RGB for rendering
-                hsv HSV = {0, 0.8, 0.8};
+typedef struct {
+    zoom_job *job;
+    int id;
+} zoom_arg;
 
-                if (d==iterations)//if in the middle
-                {
-                HSV.h = 0;
-                HSV.v = 3*(fmod(v/12.5, 1)+ 0.5*(d/iterations));
-                HSV.s = 0;                
-                }
-                else
-                {
-                HSV.h = 300 - 300*((double) d/iterations);
-                HSV.v = 1- 0.5*fmod(v/12.5, 1) + 0.5*(d/iterations) ;
-                HSV.s = 0.9 -0.9*((double) d/iterations);
-                }
+void *strip_worker(void *arg)
+{
+    zoom_job *job = ((zoom_arg *) arg)->job;
+    int id = ((zoom_arg *) arg)->id;
+
+    for (int k = id; k < job->strip_rows; k += job->n_threads)
+    {
+        double r = job->r_min * exp(k * job->step);
+
+        //a view whose pixels are one sample apart on this circle, so the precision choice
+        //is the one a normal render at this scale would make
+        mandel_view row = job->base;
+        row.zoom = 1 / (r * job->step);
+        mandel_prepare(&row, 0);
+
+        Uint8 *out = &job->strip[(size_t) k * job->strip_width * 3];
+        for (int a = 0; a < job->strip_width; a++)
+        {
+            double theta = a * job->step;
+            value_depth vd;
+            get_pixel(&row, WIDTH/2 + cos(theta) / job->step, HEIGHT/2 - sin(theta) / job->step, &vd);
+            shade_bytes(vd.value, vd.depth, row.iterations, &out[3*a]);
+        }
+    }
+    return NULL;
+}
+
+//bilinear lookup, wrapping around in angle and clamping in radius
+void strip_sample(const zoom_job *job, double row, double col, Uint8 px[3])
+{
+    if (row < 0)
+        row = 0;
+    if (row > job->strip_rows - 1)
+        row = job->strip_rows - 1;
+    int r0 = row, r1 = r0 + 1 < job->strip_rows ? r0 + 1 : r0;
+    int c0 = (int) floor(col), c1;
+    double fr = row - r0, fc = col - c0;
+    c0 %= job->strip_width;
+    if (c0 < 0)
+        c0 += job->strip_width;
+    c1 = (c0 + 1) % job->strip_width;
+
+    const Uint8 *s = job->strip;
+    size_t w = job->strip_width;
+    for (int ch = 0; ch < 3; ch++)
+    {
+        double top = s[(r0*w + c0)*3 + ch] * (1 - fc) + s[(r0*w + c1)*3 + ch] * fc;
+        double bottom = s[(r1*w + c0)*3 + ch] * (1 - fc) + s[(r1*w + c1)*3 + ch] * fc;
+        px[ch] = top * (1 - fr) + bottom * fr + 0.5;
+    }
+}
+
+void *frame_worker(void *arg)
+{
+    zoom_job *job = ((zoom_arg *) arg)->job;
+    int id = ((zoom_arg *) arg)->id;
+    Uint8 *image = malloc(WIDTH*HEIGHT*3);
+    char path[4096];
+
+    for (int f = id; image && f < job->frames; f += job->n_threads)
+    {
+        double t = job->frames > 1 ? (double) f / (job->frames - 1) : 0;
+        double z = job->zoom_from * pow(job->zoom_to / job->zoom_from, t);
 
-                rgb RGB = hsv2rgb(HSV);
-                
-                //write this pixel
-                setpixel(screen, x, y, RGB.r*256, RGB.g*256, RGB.b*256);
+        for (int y = 0; y < HEIGHT; y++)
+            for (int x = 0; x < WIDTH; x++)
+            {
+                double dx = x - WIDTH/2, dy = -(y - HEIGHT/2);
+                double r = fmax(hypot(dx, dy), 0.5) / z;
+                double row = log(r / job->r_min) / job->step;
+                double col = atan2(dy, dx) / job->step;
+                strip_sample(job, row, col, &image[(y*WIDTH + x)*3]);
             }
+
+        snprintf(path, sizeof(path), "%s%05d.ppm", job->prefix, f);
+        FILE *out = fopen(path, "wb");
+        if (!out)
+        {
+            perror(path);
+            break;
         }
+        fprintf(out, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+        fwrite(image, 3, WIDTH*HEIGHT, out);
+        fclose(out);
     }
+    free(image);
+    return NULL;
+}
 
-    if (SDL_MUSTLOCK(screen)) 
-        SDL_UnlockSurface(screen);
+double seconds_since(const struct timespec *t0)
+{
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) * 1e-9;
+}
 
-    SDL_Flip(screen);
+void zoom_usage(void)
+{
+    printf("mandel5 -e [-f func] [-c re im] [-l lo_re lo_im] [-r re im] [-i iterations]\n"
+           "           [-z from to] [-n frames] [-o prefix]\n");
 }
 
-void print_data(void)
+//headless zoom video, frames go to prefix00000.ppm and on
+int zoom_video(int argc, char *argv[])
 {
-    
-    printf("Iterations: %d\n", iterations);
-    printf("Julia value: %f, %f\n", julia_root.real, julia_root.im);
-    printf("Center: %f, %f\n", center.real, center.im);
-    printf("Zoom: %f\n", zoom);
-    printf("Smoothing: %d\n", smoothing);
-    printf("Compression Level: %d\n", compr_level);
-    printf("\n");
+    zoom_job job = {.zoom_from = 100, .zoom_to = 1e6, .frames = 300, .prefix = "frame"};
+    mandel_view *v = &job.base;
+    *v = (mandel_view) {.func = MANDEL, .center = {0.743643887037151, 0.131825904205330}, .zoom = 100,
+                        .width = WIDTH, .height = HEIGHT};
+
+    for (int i = 2; i<argc; i++)
+    {
+        int args = argv[i][0] == '-' && strchr("clrz", argv[i][1]) ? 2 : 1;
+        if (argv[i][0] != '-' || argv[i][1] == 0 || i + args >= argc)
+        {
+            zoom_usage();
+            return 1;
+        }
+        double a = atof(argv[i+1]), b = args == 2 ? atof(argv[i+2]) : 0;
+
+        switch (argv[i][1])
+        {
+            case 'f': v->func = atoi(argv[i+1]); break;
+            case 'c': v->center = (comp) {a, b}; break;
+            case 'l': v->center_lo = (comp) {a, b}; break;
+            case 'r': v->julia_root = (comp) {a, b}; break;
+            case 'i': v->iterations = atoi(argv[i+1]); break;
+            case 'z': job.zoom_from = a; job.zoom_to = b; break;
+            case 'n': job.frames = atoi(argv[i+1]); break;
+            case 'o': job.prefix = argv[i+1]; break;
+            default:
+                zoom_usage();
+                return 1;
+        }
+        i += args;
+    }
+    if (job.zoom_from <= 0 || job.zoom_to < job.zoom_from || job.frames <= 0
+            || v->func < MANDEL || v->func > SINKING_SHIP)
+    {
+        zoom_usage();
+        return 1;
+    }
+    //same budget the e key would pick at the deepest frame, kept for the whole video so colors hold still
+    if (v->iterations <= 0)
+        v->iterations = (int) pow(job.zoom_to, 0.2753)*10;
+
+    //sample spacing on the outermost circle of the first frame is one pixel, the innermost
+    //circle is half a pixel out from the center of the last frame
+    double corner = hypot(WIDTH/2, HEIGHT/2);
+    job.strip_width = (int) ceil(2*M_PI*corner);
+    job.step = 2*M_PI / job.strip_width;
+    job.r_min = 0.5 / job.zoom_to;
+    job.strip_rows = (int) ceil(log(corner / job.zoom_from / job.r_min) / job.step) + 1;
+    job.strip = malloc((size_t) job.strip_rows * job.strip_width * 3);
+    if (!job.strip)
+    {
+        fprintf(stderr, "out of memory for a %dx%d strip\n", job.strip_width, job.strip_rows);
+        return 1;
+    }
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    job.n_threads = n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : n;
+    pthread_t threads[MAX_THREADS];
+    zoom_arg args[MAX_THREADS];
+    struct timespec t0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < job.n_threads; i++)
+    {
+        args[i] = (zoom_arg) {&job, i};
+        pthread_create(&threads[i], NULL, strip_worker, &args[i]);
+    }
+    for (int i = 0; i < job.n_threads; i++)
+        pthread_join(threads[i], NULL);
+    double strip_s = seconds_since(&t0);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < job.n_threads; i++)
+        pthread_create(&threads[i], NULL, frame_worker, &args[i]);
+    for (int i = 0; i < job.n_threads; i++)
+        pthread_join(threads[i], NULL);
+    double frames_s = seconds_since(&t0);
+
+    double strip_px = (double) job.strip_rows * job.strip_width;
+    double frame_px = (double) job.frames * WIDTH * HEIGHT;
+    printf("Strip: %dx%d, %.0f samples at %d iterations in %.2f s\n",
+           job.strip_width, job.strip_rows, strip_px, v->iterations, strip_s);
+    printf("Frames: %d in %.2f s, %.1f%% of the pixels rendering every frame would iterate\n",
+           job.frames, frames_s, 100 * strip_px / frame_px);
+    free(job.strip);
+    return 0;
+}
+
+void write_input(FILE *f, const input *in)
+{
+    switch (in->type)
+    {
+        case INPUT_DRAG: fprintf(f, "%u drag %d %d\n", in->ms, in->a, in->b); break;
+        case INPUT_KEY: fprintf(f, "%u key %d %d %d\n", in->ms, in->a, in->b, in->c); break;
+        case INPUT_QUIT: fprintf(f, "%u quit\n", in->ms); break;
+        case INPUT_HOVER: fprintf(f, "%u hover %d %d\n", in->ms, in->a, in->b); break;
+    }
+}
+
+//returns 0 at the end of the file or on a line it does not understand
+int read_input(FILE *f, input *in)
+{
+    char type[8];
+    *in = (input) {0};
+    if (fscanf(f, "%u %7s", &in->ms, type) != 2)
+        return 0;
+    if (strcmp(type, "drag") == 0)
+        return in->type = INPUT_DRAG, fscanf(f, "%d %d", &in->a, &in->b) == 2;
+    if (strcmp(type, "key") == 0)
+        return in->type = INPUT_KEY, fscanf(f, "%d %d %d", &in->a, &in->b, &in->c) == 3;
+    if (strcmp(type, "hover") == 0)
+        return in->type = INPUT_HOVER, fscanf(f, "%d %d", &in->a, &in->b) == 2;
+    in->type = INPUT_QUIT;
+    return strcmp(type, "quit") == 0;
+}
+
+//the keyboard and mouse since the last call
+int poll_inputs(input *in, Uint32 ms)
+{
+    SDL_Event event;
+    int n = 0, mouse_x, mouse_y;
+
+    if (SDL_GetRelativeMouseState(&mouse_x, &mouse_y) && SDL_BUTTON(SDL_BUTTON_LEFT))
+        in[n++] = (input) {ms, INPUT_DRAG, mouse_x, mouse_y};
+
+    SDL_GetMouseState(&mouse_x, &mouse_y);
+    if (split && mouse_x < WIDTH && (mouse_x != hover_x || mouse_y != hover_y))
+        in[n++] = (input) {ms, INPUT_HOVER, mouse_x, mouse_y};
+
+    while (n < MAX_INPUTS && SDL_PollEvent(&event))
+    {
+        if (event.type == SDL_QUIT)
+            in[n++] = (input) {ms, INPUT_QUIT};
+        else if (event.type == SDL_KEYDOWN)
+            in[n++] = (input) {ms, INPUT_KEY, event.key.keysym.sym, mouse_x, mouse_y};
+    }
+    return n;
+}
+
+//the recorded inputs that are due. in fast mode everything recorded at the same time
+//as the next input, once the last frame is done
+int replay_inputs(input *in, Uint32 ms, int frame_done)
+{
+    SDL_Event event;
+    int n = 0;
+
+    //the window still needs its events handled, and closing it ends the replay
+    while (SDL_PollEvent(&event))
+        if (event.type == SDL_QUIT || (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE))
+            in[n++] = (input) {ms, INPUT_QUIT};
+    if (n)
+        return n;
+
+    if (replay_fast && !frame_done)
+        return 0;
+    Uint32 due = replay_fast ? replay_next.ms : ms;
+    while (replay_left && replay_next.ms <= due && n < MAX_INPUTS)
+    {
+        in[n++] = replay_next;
+        replay_left = read_input(replay_file, &replay_next);
+    }
+    return n;
+}
+
+//apply one input to the view, returns 1 if the view needs publishing
+int apply_input(const input *in, int *quit)
+{
+    if (in->type == INPUT_QUIT)
+    {
+        *quit = 1;
+        return 0;
+    }
+    if (in->type == INPUT_DRAG)
+    {
+        julia_root.real -= in->a/zoom;
+        julia_root.im -= in->b/zoom;
+        return 1;
+    }
+    //only the preview cares where the mouse is
+    if (in->type == INPUT_HOVER)
+    {
+        hover_x = in->a;
+        hover_y = in->b;
+        preview_stale = 1;
+        return 0;
+    }
+
+    int mouse_x = in->b, mouse_y = in->c;
+    switch(in->a)
+    {
+        case SDLK_a:
+            pan(&center.real, &center_lo.real, 10/zoom);
+            break;
+
+        case SDLK_d:
+            pan(&center.real, &center_lo.real, -10/zoom);
+            break;
+
+        case SDLK_w:
+            pan(&center.im, &center_lo.im, 10/zoom);
+            break;
+
+        case SDLK_s:
+            pan(&center.im, &center_lo.im, -10/zoom);
+            break;
+
+        case SDLK_LEFT:
+            julia_root.real += 1/zoom;
+            break;
+
+        case SDLK_RIGHT:
+            julia_root.real -= 1/zoom;
+            break;
+
+        case SDLK_UP:
+            julia_root.im += 1/zoom;
+            break;
+
+        case SDLK_DOWN:
+            julia_root.im -= 1/zoom;
+            break;
+        
+        case SDLK_e:
+            zoom *= 1.1;
+            if (!auto_iterations)
+                iterations = (int) pow(zoom, 0.2753)*10;
+            break;
+
+        case SDLK_f:
+            zoom *= 1.1;
+            pan(&center.real, &center_lo.real, -(mouse_x - WIDTH/2)/(zoom*2));
+            pan(&center.im, &center_lo.im, -(mouse_y - HEIGHT/2)/(zoom*2));
+            //iterations = (int) pow(zoom, 0.2753)*10;
+            break;
+
+
+        case SDLK_q:
+            zoom /= 1.1;
+            break;
+
+        case SDLK_ESCAPE:
+            *quit = 1;
+            break;
+
+        case SDLK_1:
+            iterations -= 1;
+            break;
+
+        case SDLK_2:
+            iterations += 1;
+            break;
+
+        case SDLK_3:
+            iterations /= 2;
+            break;
+
+        case SDLK_4:
+            iterations *= 2;
+            break;
+
+        case SDLK_r:
+            iterations = 10;
+            center = (comp) {0, 0};
+            center_lo = (comp) {0, 0};
+            zoom = 100;
+            julia_root = (comp) {0,0};
+            break;
+
+        case SDLK_x:
+            compr_level *= 2;
+            if (compr_level > 32)
+                compr_level = 1;
+            break;
+
+        case SDLK_z:
+            smoothing = !smoothing;
+            break;
+
+        case SDLK_t:
+            auto_quality = !auto_quality;
+            break;
+
+        case SDLK_i:
+            auto_iterations = !auto_iterations;
+            break;
+
+        case SDLK_b:
+            buddha = !buddha;
+            break;
+
+        case SDLK_j:
+            //second press picks the thumbnail under the mouse and shows its julia set whole
+            if (atlas)
+            {
+                view v = current_view();
+                julia_root = atlas_root(&v, mouse_x, mouse_y);
+                if (func != JULIA_3)
+                    func = JULIA;
+                center = (comp) {0, 0};
+                center_lo = (comp) {0, 0};
+                zoom = 100;
+            }
+            atlas = !atlas;
+            break;
+
+        case SDLK_v:
+            //the left half turns into the whole mandelbrot set, a second press opens the julia
+            //set the preview shows in the whole window, the way j does over an atlas
+            if (split)
+            {
+                julia_root = preview_root(hover_x, hover_y);
+                func = JULIA;
+                center = (comp) {0, 0};
+                atlas = 0;
+            }
+            else
+            {
+                julia_root = (comp) {0, 0};
+                func = MANDEL;
+                center = (comp) {0.5, 0};
+            }
+            center_lo = (comp) {0, 0};
+            zoom = 100;
+            split = !split;
+            break;
+
+        default:
+            break;
+    }
+    return 1;
+}
+
+int cmp_uint(const void *a, const void *b)
+{
+    Uint32 x = *(const Uint32*) a, y = *(const Uint32*) b;
+    return (x > y) - (x < y);
 }
 
+void replay_report(Uint32 ms)
+{
+    size_t n = n_frame_times;
+    printf("Replay: %d frames published, %zu finished, %u ms, %.1f finished frames/s\n",
+           frames_published, n, ms, ms ? n * 1000.0 / ms : 0.0);
+    if (!n)
+        return;
+    qsort(frame_times, n, sizeof(*frame_times), cmp_uint);
+    printf("Frame latency: p50 %u ms, p90 %u ms, p99 %u ms, max %u ms\n",
+           frame_times[n/2], frame_times[n*9/10], frame_times[n*99/100], frame_times[n-1]);
+}
+
+void usage(void)
+{
+    printf("mandel5 [-r record.txt | -p replay.txt [-f] [-n]]\n"
+           "mandel5 -w      tile worker for coordinator and tileserver\n"
+           "mandel5 -e ...  zoom video, -e -h for options\n");
+}
 
 int main(int argc, char* argv[])
 {
     SDL_Surface *screen;
-    SDL_Event event;
     
+    if (argc > 1 && strcmp(argv[1], "-w") == 0)
+        return tile_worker();
+    if (argc > 1 && strcmp(argv[1], "-e") == 0)
+        return zoom_video(argc, argv);
+
+    for (int i = 1; i<argc; i++)
+    {
+        if (strcmp(argv[i], "-f") == 0)
+            replay_fast = 1;
+        else if (strcmp(argv[i], "-n") == 0)
+            setenv("SDL_VIDEODRIVER", "dummy", 1);
+        else if (strcmp(argv[i], "-r") == 0 && i+1 < argc && !record_file)
+        {
+            if (!(record_file = fopen(argv[++i], "w")))
+            {
+                perror(argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-p") == 0 && i+1 < argc && !replay_file)
+        {
+            if (!(replay_file = fopen(argv[++i], "r")))
+            {
+                perror(argv[i]);
+                return 1;
+            }
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (replay_file)
+        replay_left = read_input(replay_file, &replay_next);
+
     int quit = 0;
     int keypress = 1;
-    int h = 0;
+    int degraded = 0;
+    int shown_split = 0;
+    Uint32 last_input = 0;
+    Uint32 last_buddha_draw = 0, last_buddha_report = 0;
 
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
         return 1;
@@ -333,136 +1711,101 @@ int main(int argc, char* argv[])
         SDL_Quit();
         return 1;
     }
+    //a copy, the screen's own goes away whenever the split view resizes the window
+    static SDL_PixelFormat format;
+    format = *screen->format;
+    pixel_format = &format;
+    start_workers();
+    Uint32 session_start = SDL_GetTicks();
 
     while(!quit)
     {
+        //never block on rendering, just point the workers at the newest view and show what is done
         if (keypress) 
         {
+            last_input = SDL_GetTicks();
+            choose_quality(1);
+            degraded = live_compr != compr_level || live_iterations != iterations || auto_iterations;
+            publish_view();
+            frames_published++;
             print_data();
-            DrawScreen(screen, h++);
             keypress = 0;
+            //the point under the mouse moved with the view
+            preview_stale = 1;
         }
-
-        int mouse_x, mouse_y;
-        if (SDL_GetRelativeMouseState(&mouse_x, &mouse_y) && SDL_BUTTON(SDL_BUTTON_LEFT))
+        else if (degraded && SDL_GetTicks() - last_input > SETTLE_MS)
         {
-            julia_root.real -= mouse_x/zoom;
-            julia_root.im -= mouse_y/zoom;
-            keypress = 1;
+            //user stopped, redraw at full quality. a probe that had to widen its budget may
+            //not have looked deep enough yet, it gets another go after the next SETTLE_MS
+            int widened = 0;
+            if (auto_iterations)
+            {
+                int n = probe_iterations();
+                widened = n > iterations;
+                iterations = n;
+            }
+            choose_quality(0);
+            degraded = widened;
+            last_input = SDL_GetTicks();
+            publish_view();
+            frames_published++;
+            print_data();
         }
-        
-        SDL_GetMouseState(&mouse_x, &mouse_y);
-            
-
-        while(SDL_PollEvent(&event))
+        if (split != shown_split)
+        {
+            if (!(screen = SDL_SetVideoMode(split ? 2*WIDTH : WIDTH, HEIGHT, DEPTH, SDL_HWSURFACE)))
+                break;
+            shown_split = split;
+            atomic_store(&dirty, 1);
+        }
+        if (split && preview_stale && (preview_finished() || SDL_GetTicks() - preview_start > PREVIEW_MS))
+            publish_preview();
+        if (buddha && SDL_GetTicks() - last_buddha_draw > BUDDHA_PRESENT_MS)
         {
-            switch(event.type)
+            buddha_draw();
+            last_buddha_draw = SDL_GetTicks();
+            Uint32 since = SDL_GetTicks() - last_buddha_report;
+            if (since > 1000)
             {
-                case SDL_QUIT:
-                    quit = 1;
-                    break;
-                case SDL_KEYDOWN:
-                    keypress = 1;
-                    switch(event.key.keysym.sym)
-                    {
-                        case SDLK_a:
-                            center.real += 10/zoom;
-                            break;
-
-                        case SDLK_d:
-                            center.real -= 10/zoom;
-                            break;
-
-                        case SDLK_w:
-                            center.im += 10/zoom;
-                            break;
-
-                        case SDLK_s:
-                            center.im -= 10/zoom;
-                            break;
-
-                        case SDLK_LEFT:
-                            julia_root.real += 1/zoom;
-                            break;
-
-                        case SDLK_RIGHT:
-                            julia_root.real -= 1/zoom;
-                            break;
-
-                        case SDLK_UP:
-                            julia_root.im += 1/zoom;
-                            break;
-
-                        case SDLK_DOWN:
-                            julia_root.im -= 1/zoom;
-                            break;
-                        
-                        case SDLK_e:
-                            zoom *= 1.1;
-                            iterations = (int) pow(zoom, 0.2753)*10;
-                            break;
-
-                        case SDLK_f:
-                            zoom *= 1.1;
-                            center.real -= (mouse_x - WIDTH/2)/(zoom*2);
-                            center.im -= (mouse_y - HEIGHT/2)/(zoom*2);
-                            //iterations = (int) pow(zoom, 0.2753)*10;
-                            break;
-
-
-                        case SDLK_q:
-                            zoom /= 1.1;
-                            break;
-
-                        case SDLK_ESCAPE:
-                            quit = 1;
-                            break;
-
-                        case SDLK_1:
-                            iterations -= 1;
-                            break;
-
-                        case SDLK_2:
-                            iterations += 1;
-                            break;
-
-                        case SDLK_3:
-                            iterations /= 2;
-                            break;
-
-                        case SDLK_4:
-                            iterations *= 2;
-                            break;
-
-                        case SDLK_r:
-                            iterations = 10;
-                            center = (comp) {0, 0};
-                            zoom = 100;
-                            julia_root = (comp) {0,0};
-                            break;
-
-                        case SDLK_x:
-                            compr_level *= 2;
-                            if (compr_level > 32)
-                                compr_level = 1;
-                            break;
-
-                        case SDLK_z:
-                            smoothing = !smoothing;
-                            break;
-
-                        default:
-                            break;
-                    }
-                    break;
+                printf("Buddhabrot: %.0f samples/s\n", atomic_exchange(&buddha_samples, 0) * 1000.0 / since);
+                last_buddha_report = SDL_GetTicks();
             }
         }
+        present(screen);
+        time_frame();
+
+        input in[MAX_INPUTS];
+        int n;
+        Uint32 ms = SDL_GetTicks() - session_start;
+        int frame_done = (frame_timed || published.buddha) && !degraded;
+
+        if (replay_file)
+        {
+            n = replay_inputs(in, ms, frame_done);
+            //out of input, stop once the last frame is on screen
+            if (!n && !replay_left && frame_done)
+                quit = 1;
+        }
+        else
+            n = poll_inputs(in, ms);
+
+        for (int i = 0; i < n; i++)
+        {
+            if (record_file)
+                write_input(record_file, &in[i]);
+            keypress |= apply_input(&in[i], &quit);
+        }
+
+        //let the workers have the cpu while nothing is happening
+        if (!keypress)
+            SDL_Delay(1);
     }
 
+    if (replay_file)
+        replay_report(SDL_GetTicks() - session_start);
+    if (record_file)
+        fclose(record_file);
     SDL_Quit();
 
     return 0;
 }
-
-
-
@@ -1,28 +1,416 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <SDL.h>
 #include <math.h>
 #include "handle_segfault.c"
+#include "mem_map.h"
+#include "frame_format.h"
 
 #include <unistd.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
 
 #define WIDTH 640
 #define HEIGHT 480
 
 
+//where nothing is mapped, a blue the low byte of an int can't make
+#define UNMAPPED 0xff0000c0u
+//frames between rereading the map, it costs the target a lock on its address space
+#define MAPS_EVERY 30
+//iovecs per process_vm_readv, the kernel takes at most 1024
+#define READ_BATCH 1024
+//pages each thread probes when this process reads itself without process_vm_readv
+#define PROBE_PAGES_PER_THREAD 4096
+//frames between clearing the soft-dirty bits. every clear makes the target take a fault on
+//the next write to each of its pages, in between pages written since the last clear are read
+//again every frame and their hash says if they really changed
+#define SOFT_DIRTY_EVERY 15
+
+
 volatile sig_atomic_t stop;
+size_t page_size;           //sysconf(_SC_PAGESIZE), set first thing in main
 
 void inthand(int signum) {
     stop = 1;
 }
 
+int cols, rows;
+
+//a stretch of the frame: count ints from address addr, out of range of the map or -1 where
+//nothing is mapped
+typedef struct {
+    size_t at, count;
+    uintptr_t addr;
+    int range;
+    size_t got;             //ints read_pieces could read
+} piece;
+
+//split n ints of memory from address from into pieces along the ranges of the map
+int pieces_at(const mem_map *m, uintptr_t from, size_t n, piece *out)
+{
+    uintptr_t to = from + n*sizeof(int);
+    int k = maps_find(m, from), np = 0;
+
+    for (uintptr_t p = from; p < to;)
+    {
+        uintptr_t end;
+        int range = -1;
+        if (k < m->n && m->r[k].start <= p)
+        {
+            end = m->r[k].end < to ? m->r[k].end : to;
+            range = k++;
+        }
+        else
+            end = k < m->n && m->r[k].start < to ? m->r[k].start : to;
+        out[np++] = (piece) {(p - from) / sizeof(int), (end - p) / sizeof(int), p, range};
+        p = end;
+    }
+    return np;
+}
+
+//the same for n ints of all readable memory of the map laid end to end, from byte off of it
+int pieces_readable(const mem_map *m, size_t off, size_t n, piece *out)
+{
+    size_t at = 0;
+    int np = 0;
+    for (int k = maps_find_readable(m, off); k < m->n && at < n; k++)
+    {
+        const mem_range *r = &m->r[k];
+        if (!r->readable)
+            continue;
+        size_t skip = off > r->before ? off - r->before : 0;
+        size_t count = (r->end - r->start - skip) / sizeof(int);
+        count = count < n - at ? count : n - at;
+        out[np++] = (piece) {at, count, r->start + skip, k};
+        at += count;
+    }
+    if (at < n)
+        out[np++] = (piece) {at, n - at, 0, -1};
+    return np;
+}
+
+//color ints of a piece by their low byte, or paint them where they couldn't be read
+void paint(Uint32 *frame, const unsigned int *copy, size_t at, size_t count, int readable)
+{
+    for (size_t j = at; j < at + count; j++)
+        frame[j] = readable ? rgb332(copy[j] & 0xff) : UNMAPPED;
+}
+
+//process_vm_readv on this process done by hand, for when a seccomp filter doesn't allow the
+//call. the pages are probed first so a copy never faults halfway, and like the real call it
+//stops at the first one that isn't there
+ssize_t read_self(const struct iovec *local, const struct iovec *remote, int n)
+{
+    ssize_t total = 0;
+    for (int i = 0; i < n; i++)
+    {
+        uintptr_t skip = (uintptr_t) remote[i].iov_base % page_size;
+        size_t len = remote[i].iov_len, pages = (skip + len + page_size - 1) / page_size;
+        uint8_t bitmap[pages / 8 + 1];
+        size_t there = probe_range_threads(remote[i].iov_base, len, bitmap, pages / PROBE_PAGES_PER_THREAD + 1);
+
+        size_t ok = len;
+        if (there < pages)
+        {
+            size_t k = 0;
+            while (bitmap[k/8] >> k%8 & 1)
+                k++;
+            ok = k ? k*page_size - skip : 0;
+        }
+        //unmapped since it was probed, count none of it
+        if (ok && !probe_copy(local[i].iov_base, remote[i].iov_base, ok))
+            return total;
+        total += ok;
+        if (ok < len)
+            break;
+    }
+    return total;
+}
+
+//copy the readable pieces out of pid with as few process_vm_readv calls as it takes and color
+//the frame, unless it is NULL. a call stops at the first piece it can't read after all (a
+//file mapped past its end, a range gone since the map was read), that one is painted as
+//unmapped from where it failed and the next call starts after it. returns how many pixels
+//were readable, -1 if pid can't be read at all
+int read_pieces(pid_t pid, const mem_map *m, piece *pc, int np, Uint32 *frame, unsigned int *copy)
+{
+    struct iovec local[READ_BATCH], remote[READ_BATCH];
+    piece *want[READ_BATCH];
+    int valid = 0;
+
+    for (int k = 0; k < np;)
+    {
+        int n = 0;
+        for (; k < np && n < READ_BATCH; k++)
+        {
+            piece *p = &pc[k];
+            p->got = 0;
+            if (p->range < 0 || !m->r[p->range].readable)
+            {
+                if (frame)
+                    paint(frame, copy, p->at, p->count, 0);
+                continue;
+            }
+            local[n] = (struct iovec) {copy + p->at, p->count * sizeof(int)};
+            remote[n] = (struct iovec) {(void *) p->addr, p->count * sizeof(int)};
+            want[n++] = p;
+        }
+
+        for (int i = 0; i < n;)
+        {
+            ssize_t got = process_vm_readv(pid, local + i, n - i, remote + i, n - i, 0);
+            if (got < 0 && (errno == ENOSYS || errno == EPERM) && pid == getpid())
+                got = read_self(local + i, remote + i, n - i);
+            if (got < 0 && errno != EFAULT)
+                return -1;
+            if (got < 0)
+                got = 0;
+            for (; i < n && (size_t) got >= local[i].iov_len; i++)
+            {
+                got -= local[i].iov_len;
+                want[i]->got = want[i]->count;
+                if (frame)
+                    paint(frame, copy, want[i]->at, want[i]->count, 1);
+                valid += want[i]->count;
+            }
+            if (i < n)
+            {
+                size_t done = got / sizeof(int);
+                want[i]->got = done;
+                if (frame)
+                {
+                    paint(frame, copy, want[i]->at, done, 1);
+                    paint(frame, copy, want[i]->at + done, want[i]->count - done, 0);
+                }
+                valid += done;
+                i++;
+            }
+        }
+    }
+    return valid;
+}
+
+//-H, a heatmap of what changes. pages in view are hashed every frame and light up when their
+//hash changes, then cool down over a second or so. the rest is shown dim and not redrawn.
+//where the kernel keeps soft-dirty bits only pages written to since the last frame are read
+//at all (bit 55 of /proc/pid/pagemap, reset through clear_refs), otherwise every one in view
+int heat_mode = 0;
+int pagemap_fd = -1, clear_refs_fd = -1;    //-1 without soft-dirty bits
+
+typedef struct {
+    size_t at, count, got;
+    uintptr_t addr;
+    int range;
+    int dirty;              //read this frame
+    int heat;               //255 when it just changed
+    uint64_t hash;
+} page_slot;
+
+page_slot *slots, *new_slots;
+int n_slots = -1;           //-1 draws everything again
+piece *dirty;
+
+//soft-dirty bits are there if clearing ours and writing to a page sets its bit again
+int soft_dirty_open(pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/pagemap", (int) pid);
+    pagemap_fd = open(path, O_RDONLY);
+    snprintf(path, sizeof(path), "/proc/%d/clear_refs", (int) pid);
+    clear_refs_fd = open(path, O_WRONLY);
+
+    int ok = 0;
+    int self_map = open("/proc/self/pagemap", O_RDONLY);
+    int self_clear = open("/proc/self/clear_refs", O_WRONLY);
+    volatile char *page = aligned_alloc(page_size, page_size);
+    if (page && self_map >= 0 && self_clear >= 0)
+    {
+        uint64_t entry;
+        page[0] = 1;
+        if (write(self_clear, "4", 1) == 1)
+        {
+            page[0] = 2;
+            ok = pread(self_map, &entry, sizeof(entry), (uintptr_t) page / page_size * sizeof(entry))
+                 == sizeof(entry) && (entry >> 55 & 1);
+        }
+    }
+    free((void *) page);
+    close(self_map);
+    close(self_clear);
+    if (!ok || pagemap_fd < 0 || clear_refs_fd < 0)
+    {
+        close(pagemap_fd);
+        close(clear_refs_fd);
+        pagemap_fd = clear_refs_fd = -1;
+    }
+    return pagemap_fd >= 0;
+}
+
+//mark the slots written to since the soft-dirty bits were last cleared, asking pagemap once
+//for each run of pages that follow each other
+void find_dirty(void)
+{
+    uint64_t entry[512];
+    for (int i = 0; i < n_slots;)
+    {
+        uintptr_t first = slots[i].addr / page_size;
+        int run = 1;
+        while (i + run < n_slots && run < 512 && slots[i + run].addr / page_size == first + run)
+            run++;
+        ssize_t got = pread(pagemap_fd, entry, run * sizeof(uint64_t), first * sizeof(uint64_t));
+        for (int k = 0; k < run; k++, i++)
+            slots[i].dirty = got < (ssize_t) ((k + 1) * sizeof(uint64_t)) || (entry[k] >> 55 & 1);
+    }
+}
+
+//fnv-1a on 64 bit words in four independent lanes, so the multiplies overlap
+uint64_t hash_ints(const unsigned int *p, size_t n)
+{
+    uint64_t h[4] = {0xcbf29ce484222325u ^ n, 1, 2, 3}, w[4];
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        memcpy(w, p + i, sizeof(w));
+        for (int k = 0; k < 4; k++)
+            h[k] = (h[k] ^ w[k]) * 0x100000001b3u;
+    }
+    for (; i < n; i++)
+        h[0] = (h[0] ^ p[i]) * 0x100000001b3u;
+    return ((h[0] * 31 + h[1]) * 31 + h[2]) * 31 + h[3];
+}
+
+//memory dimmed to a quarter with the heat added in red going to yellow
+Uint32 shade(unsigned int v, int heat)
+{
+    Uint32 c = rgb332(v & 0xff);
+    int r = (c >> 16 & 0xff) / 4 + heat, g = (c >> 8 & 0xff) / 4 + heat / 2, b = (c & 0xff) / 4;
+    return 0xff000000u | (r > 255 ? 255 : r) << 16 | (g > 255 ? 255 : g) << 8 | b;
+}
+
+//one -H frame of the pieces in view, returns how many pages changed, -1 if pid can't be read
+int heat_frame(pid_t pid, const mem_map *m, const piece *pc, int np, Uint32 *frame, unsigned int *copy)
+{
+    //the pages of the readable pieces. if they are the ones of last frame hashes and heat
+    //carry over, otherwise everything starts again from this frame
+    int n = 0;
+    for (int k = 0; k < np; k++)
+    {
+        if (pc[k].range < 0 || !m->r[pc[k].range].readable)
+            continue;
+        for (uintptr_t a = pc[k].addr, end = a + pc[k].count*sizeof(int); a < end;)
+        {
+            uintptr_t next = (a | (page_size - 1)) + 1;
+            next = next < end ? next : end;
+            new_slots[n++] = (page_slot) {pc[k].at + (a - pc[k].addr) / sizeof(int),
+                                          (next - a) / sizeof(int), 0, a, pc[k].range};
+            a = next;
+        }
+    }
+    int fresh = n != n_slots;
+    for (int i = 0; i < n && !fresh; i++)
+        fresh = new_slots[i].addr != slots[i].addr || new_slots[i].at != slots[i].at
+                || new_slots[i].count != slots[i].count;
+    if (fresh)
+    {
+        page_slot *t = slots;
+        slots = new_slots;
+        new_slots = t;
+        n_slots = n;
+        for (int k = 0; k < np; k++)
+            if (pc[k].range < 0 || !m->r[pc[k].range].readable)
+                paint(frame, copy, pc[k].at, pc[k].count, 0);
+    }
+    else
+        for (int i = 0; i < n; i++)
+            slots[i].range = new_slots[i].range;    //the map may have been read again
+
+    if (fresh || pagemap_fd < 0)
+        for (int i = 0; i < n_slots; i++)
+            slots[i].dirty = 1;
+    else
+        find_dirty();
+    int nd = 0;
+    for (int i = 0; i < n_slots; i++)
+        if (slots[i].dirty)
+            dirty[nd++] = (piece) {slots[i].at, slots[i].count, slots[i].addr, slots[i].range};
+    if (read_pieces(pid, m, dirty, nd, NULL, copy) < 0)
+        return -1;
+    //bits that can't be cleared any more would only ever pile up, read every page from now on
+    static int since_clear;
+    if (clear_refs_fd >= 0 && ++since_clear >= SOFT_DIRTY_EVERY)
+    {
+        since_clear = 0;
+        if (write(clear_refs_fd, "4", 1) != 1)
+        {
+            printf("clearing soft-dirty bits failed, -H reads every page\n");
+            close(pagemap_fd);
+            close(clear_refs_fd);
+            pagemap_fd = clear_refs_fd = -1;
+        }
+    }
+
+    //only pages that are new, changed or still warm are drawn again
+    int changed = 0;
+    for (int i = 0, d = 0; i < n_slots; i++)
+    {
+        page_slot *s = &slots[i];
+        int draw = s->heat > 0 || fresh;
+        if (s->heat > 0)
+            s->heat -= s->heat / 8 + 1;
+        s->heat = s->heat < 0 ? 0 : s->heat;
+        if (s->dirty)
+        {
+            s->got = dirty[d++].got;
+            uint64_t h = hash_ints(copy + s->at, s->got);
+            if (!fresh && h != s->hash)
+            {
+                s->heat = 255;
+                changed++;
+                draw = 1;
+            }
+            s->hash = h;
+            paint(frame, copy, s->at + s->got, s->count - s->got, 0);
+        }
+        if (!draw)
+            continue;
+        for (size_t j = s->at; j < s->at + s->got; j++)
+            frame[j] = shade(copy[j], s->heat);
+    }
+    return changed;
+}
+
+//what the mouse is over, for the title
+void label(char *title, size_t size, const mem_map *m, const piece *pc, int np, int x, int y)
+{
+    size_t j = (size_t) y*cols + x;
+    for (int k = 0; k < np; k++)
+        if (j >= pc[k].at && j < pc[k].at + pc[k].count)
+        {
+            uintptr_t addr = pc[k].addr + (j - pc[k].at) * sizeof(int);
+            if (pc[k].range < 0)
+                snprintf(title, size, "0x%lx unmapped", (unsigned long) addr);
+            else
+            {
+                const mem_range *r = &m->r[pc[k].range];
+                snprintf(title, size, "0x%lx %s %s  (0x%lx-0x%lx)", (unsigned long) addr, r->perms,
+                         r->name[0] ? r->name : "[anon]", (unsigned long) r->start, (unsigned long) r->end);
+            }
+            return;
+        }
+    snprintf(title, size, "mem-hack");
+}
 
 int main(int argc, char* argv[])
 {
     debug_enable_sigsev_handler();
+    page_size = sysconf(_SC_PAGESIZE);
 
     int breakmode = 0;
     int pxp = 1;
+    pid_t pid = 0;
 
     for (int i = 1; i<argc; i++)
     {
@@ -45,6 +433,16 @@ int main(int argc, char* argv[])
                     printf("big pix n = %d!\n", pxp);
                     break;
 
+                case 'P':
+                    pid = atoi(argv[++i]);
+                    printf("pid %d!\n", (int) pid);
+                    break;
+
+                case 'H':
+                    heat_mode = 1;
+                    printf("heat!\n");
+                    break;
+
                 default:
                     printf("Not recorgnized\n");
             }
@@ -54,11 +452,57 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (pxp < 1)
+        pxp = 1;
+    cols = WIDTH / pxp;
+    rows = HEIGHT / pxp;
+
+    //-P pid shows all readable memory of another process end to end, from the lowest address,
+    //scrolled with the keys. otherwise this one is shown from a peek at the heap past a big
+    //block that is given back right away, a screen of ints further on every frame
+    int *die = malloc(WIDTH*HEIGHT*10);
+    for (int foo = 0; foo < 900; foo++)
+        *(die+foo) = 100;
+    int *safe = die;
+    free(die);
+
+    mem_map map = {0};
+    size_t n = (size_t) cols*rows;
+    Uint32 *frame = malloc(n*sizeof(Uint32));
+    unsigned int *copy = malloc(n*sizeof(int));
+    //ranges are whole pages, so a frame crosses at most two edges per page
+    size_t max_pieces = n*sizeof(int)/page_size*2 + 4;
+    piece *pieces = malloc(max_pieces * sizeof(piece));
+    //pieces cut at page edges for -H
+    slots = malloc(2*max_pieces * sizeof(page_slot));
+    new_slots = malloc(2*max_pieces * sizeof(page_slot));
+    dirty = malloc(2*max_pieces * sizeof(piece));
+    if (!frame || !copy || !pieces || !slots || !new_slots || !dirty)
+    {
+        printf("out of memory\n");
+        return EXIT_FAILURE;
+    }
+    if (!maps_load(&map, pid))
+    {
+        printf("no process %d\n", (int) pid);
+        return EXIT_FAILURE;
+    }
+    if (heat_mode && !soft_dirty_open(pid ? pid : getpid()))
+        printf("no soft-dirty bits, -H reads every page\n");
+    else if (heat_mode && pid)
+        printf("note: -H clears the soft-dirty bits of process %d every %d frames, after each clear "
+               "its first write to every page takes a fault, so it runs slower while watched\n",
+               (int) pid, SOFT_DIRTY_EVERY);
+
     SDL_Event event;
     
     SDL_Window *window;
     SDL_Renderer *renderer;
+    SDL_Texture *texture;
+    SDL_SetHint(SDL_HINT_RENDER_VSYNC, "1");
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
     SDL_CreateWindowAndRenderer(WIDTH, HEIGHT, 0, &window, &renderer);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, cols, rows);
     SDL_RenderClear(renderer);
     int * crash = NULL;
     signal(SIGINT, inthand);
@@ -67,9 +511,13 @@ int main(int argc, char* argv[])
     int quit = 0;
     int nomore = 0;
     int i = 0;
-    while (!stop)
+    int frames = 0;
+    size_t offset = 0;          //-P, byte of the readable memory at the top left
+    int mouse_x = 0, mouse_y = 0;
+    while (!stop && !quit)
     {
-        if (1 || SDL_PollEvent(&event))
+        size_t screen = n*sizeof(int), line = cols*sizeof(int);
+        while (SDL_PollEvent(&event))
         {
 
             switch(event.type) {
@@ -78,7 +526,12 @@ int main(int argc, char* argv[])
                     break;
 
                 case SDL_MOUSEMOTION:
-                    //....
+                    mouse_x = event.motion.x / pxp;
+                    mouse_y = event.motion.y / pxp;
+                    break;
+
+                case SDL_MOUSEWHEEL:
+                    offset += event.wheel.y > 0 ? -8*line : 8*line;
                     break;
 
                 case SDL_KEYDOWN:
@@ -90,66 +543,82 @@ int main(int argc, char* argv[])
                         case SDL_SCANCODE_D:
                             *crash = 1;
                             break; // never run
+
+                        //-P scrolls by a line or a screen, n goes to the next range
+                        case SDLK_UP: offset -= line; break;
+                        case SDLK_DOWN: offset += line; break;
+                        case SDLK_PAGEUP: offset -= screen; break;
+                        case SDLK_PAGEDOWN: offset += screen; break;
+                        case SDLK_HOME: offset = 0; break;
+                        case SDLK_END: offset = map.readable; break;
+                        case SDLK_h:
+                            heat_mode = !heat_mode;
+                            n_slots = -1;
+                            break;
+
+                        case SDLK_n:
+                        {
+                            int k = maps_find_readable(&map, offset);
+                            while (k + 1 < map.n && !map.r[++k].readable);
+                            offset = k < map.n ? map.r[k].before : map.readable;
+                            break;
+                        }
                     }
                     break;
                     // cases for other events
             }
         }
 
-        SDL_RenderClear(renderer);
         if (nomore) continue;
 
+        //mappings come and go, what went away since is just painted unmapped
+        if (++frames % MAPS_EVERY == 0)
+            maps_load(&map, pid);
 
-        int *die = malloc(WIDTH*HEIGHT*10);
-        for (int foo = 0; foo < 900; foo++)
-            *(die+foo) = 100;
-        int *safe = die;
-        free(die);
-        
-        int valid_pixels = 0;
-
-        i = (i+1)%100;
-        printf("%d\n", i);
-        fflush(stdout); 
-        for (int y = 0; y < HEIGHT; ++y)
+        int np;
+        if (pid)
         {
-            for (int x = 0; x < WIDTH; ++x)
-            {
-                unsigned int ch = 0;
-                //debug_print_pointer((safe + x + y*HEIGHT + WIDTH*HEIGHT*i));
-                debug_catch_sigsegv_mode = true;
-                if (sigsetjmp(jbuf, !0) == 0)
-                {
-                    ch =  *(safe + x + y*(HEIGHT/pxp) + (WIDTH*HEIGHT/(pxp*pxp))*i);
-                    valid_pixels++;
-                }
-                else
-                {
-                    debug_catch_sigsegv_mode = false;
-                    continue;
-                }
-
-                debug_catch_sigsegv_mode = false;
-
+            //scrolled up past the top wraps around, keep it on the map
+            if (offset > map.readable)
+                offset = offset > (size_t) -1 / 2 ? 0 : map.readable;
+            if (offset + screen > map.readable)
+                offset = map.readable > screen ? map.readable - screen : 0;
+            offset -= offset % line;
+            np = pieces_readable(&map, offset, n, pieces);
+        }
+        else
+        {
+            //the heatmap stays on one place to see it change
+            if (!heat_mode)
+                i = (i+1)%100;
+            printf("%d\n", i);
+            fflush(stdout); 
+            np = pieces_at(&map, (uintptr_t) (safe + n*i), n, pieces);
+        }
+        int valid_pixels = heat_mode ? heat_frame(pid ? pid : getpid(), &map, pieces, np, frame, copy)
+                                     : read_pieces(pid ? pid : getpid(), &map, pieces, np, frame, copy);
+        if (valid_pixels < 0)
+        {
+            printf("can't read process %d: %s\n", (int) pid, strerror(errno));
+            break;
+        }
+        if (!pid)
+            printf(heat_mode ? "changed pages: %d\n" : "valid pixels: %d\n", valid_pixels);
 
+        char title[256];
+        label(title, sizeof(title), &map, pieces, np, mouse_x, mouse_y);
+        SDL_SetWindowTitle(window, title);
 
-                int rgb[3];
-                rgb[0] = (0b111 & ch) * 32;
-                rgb[1] = (0b111 & (ch >> 3)) * 32;
-                rgb[2] = (0b11 & (ch >> 6)) * 32;
-                int remaineder = (ch >> 8);
-                SDL_SetRenderDrawColor(renderer, rgb[0], rgb[1], rgb[2], 255);
-                SDL_RenderDrawPoint(renderer, x, y);
-            }
-        }
-        printf("valid pixels: %d\n", valid_pixels);
+        SDL_UpdateTexture(texture, NULL, frame, cols*sizeof(Uint32));
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, NULL, &(SDL_Rect) {0, 0, cols*pxp, rows*pxp});
         SDL_RenderPresent(renderer);
-        SDL_Delay(50);
     }
 
 
 
 
+    SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+//the address ranges a process has mapped, from /proc/<pid>/maps, so memory can be walked
+//without touching what isn't there. ranges come sorted and don't overlap
+
+typedef struct {
+    uintptr_t start, end;
+    int readable;
+    size_t before;          //bytes of readable ranges below this one
+    char perms[5];
+    char name[80];          //file, [heap], [stack]..., empty for anonymous memory
+} mem_range;
+
+typedef struct {
+    mem_range *r;
+    int n, cap;
+    size_t readable;        //bytes in all readable ranges
+} mem_map;
+
+//(re)read the map of pid, 0 for this process. returns 0 if it couldn't
+int maps_load(mem_map *m, pid_t pid)
+{
+    char path[64];
+    if (pid)
+        snprintf(path, sizeof(path), "/proc/%d/maps", (int) pid);
+    else
+        snprintf(path, sizeof(path), "/proc/self/maps");
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    char line[512];
+    m->n = 0;
+    m->readable = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        mem_range r = {0};
+        unsigned long start, end;
+        if (sscanf(line, "%lx-%lx %4s %*s %*s %*s %79[^\n]", &start, &end, r.perms, r.name) < 3)
+            continue;
+        if (m->n == m->cap)
+        {
+            int cap = m->cap ? 2*m->cap : 256;
+            mem_range *grown = realloc(m->r, cap * sizeof(mem_range));
+            if (!grown)
+                break;
+            m->r = grown;
+            m->cap = cap;
+        }
+        r.start = start;
+        r.end = end;
+        r.readable = r.perms[0] == 'r';
+        r.before = m->readable;
+        if (r.readable)
+            m->readable += end - start;
+        m->r[m->n++] = r;
+    }
+    fclose(f);
+    return 1;
+}
+
+//index of the first range that ends after addr, m->n if there is none
+int maps_find(const mem_map *m, uintptr_t addr)
+{
+    int lo = 0, hi = m->n;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (m->r[mid].end <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+//the readable range holding byte off of all readable memory laid end to end, m->n past the end
+int maps_find_readable(const mem_map *m, size_t off)
+{
+    int lo = 0, hi = m->n;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        const mem_range *r = &m->r[mid];
+        if (!r->readable ? r->before <= off : r->before + (r->end - r->start) <= off)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
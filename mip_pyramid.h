@@ -0,0 +1,233 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "frame_format.h"
+
+//overviews of a file shown as an image, for stdin-sdl -m. the file is mapped and read as rows
+//of stride bytes in one of the packed formats of frame_format.h. level z has one pixel for
+//every 2^z by 2^z pixels of the file, the average of their colors, in 0xAARRGGBB
+//
+//levels from MIP_FIRST up are built once in the background and kept: the file is read front
+//to back a single time for level MIP_FIRST and every level above comes from the one below it.
+//below MIP_FIRST a shown pixel is at most 4x4 file pixels, cheap enough to average straight
+//from the mapping whenever the view moves, and keeping those levels would cost more memory
+//than the file itself. a level that is only partly built is used as far as it goes
+
+#define MIP_FIRST 3
+#define MIP_LEVELS 48
+#define MIP_MAX_FACTOR (1 << MIP_FIRST)     //most pixels in each direction one pixel averages
+
+typedef struct {
+    const uint8_t *file;
+    size_t file_size, stride;
+    int bytes;                          //per file pixel
+    row_converter convert;
+    int levels;                         //the last one is a single pixel
+    int64_t w[MIP_LEVELS], h[MIP_LEVELS];
+    uint32_t *pixels[MIP_LEVELS];       //NULL below MIP_FIRST
+    size_t size[MIP_LEVELS];
+    _Atomic int64_t rows_done[MIP_LEVELS];
+} mip_pyramid;
+
+//room to average one row, each thread that does it needs its own
+typedef struct {
+    uint32_t *row;                      //converted file pixels
+    uint32_t *rb, *ag;                  //channel sums, two to a word
+    int cap;                            //pixels out
+} mip_scratch;
+
+int mip_scratch_init(mip_scratch *t, int cap)
+{
+    t->row = malloc((size_t) cap * MIP_MAX_FACTOR * sizeof(uint32_t));
+    t->rb = malloc((size_t) cap * sizeof(uint32_t));
+    t->ag = malloc((size_t) cap * sizeof(uint32_t));
+    t->cap = cap;
+    return t->row && t->rb && t->ag;
+}
+
+void mip_close(mip_pyramid *p);
+
+//map path as width pixels per row, returns 0 if it can't be read or is shorter than a row.
+//levels are reserved but not touched, memory is only used as they get built
+int mip_open(mip_pyramid *p, const char *path, int width, size_t stride, int format)
+{
+    struct stat st;
+    memset(p, 0, sizeof(*p));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < stride || width <= 0)
+    {
+        close(fd);
+        return 0;
+    }
+    p->file_size = st.st_size;
+    p->file = mmap(NULL, p->file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p->file == MAP_FAILED)
+    {
+        p->file = NULL;
+        return 0;
+    }
+
+    p->stride = stride;
+    p->bytes = frame_formats[format].bytes;
+    p->convert = format_converter(format);
+    p->w[0] = width;
+    p->h[0] = p->file_size / stride;     //a partial last row is left out
+    int z = 0;
+    while (p->w[z] > 1 || p->h[z] > 1)
+    {
+        z++;
+        p->w[z] = (p->w[z-1] + 1) / 2;
+        p->h[z] = (p->h[z-1] + 1) / 2;
+    }
+    p->levels = z + 1;
+
+    for (z = MIP_FIRST; z < p->levels; z++)
+    {
+        p->size[z] = p->w[z] * p->h[z] * sizeof(uint32_t);
+        p->pixels[z] = mmap(NULL, p->size[z], PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p->pixels[z] == MAP_FAILED)
+        {
+            p->pixels[z] = NULL;
+            mip_close(p);
+            return 0;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(p->pixels[z], p->size[z], MADV_HUGEPAGE);
+#endif
+    }
+    return 1;
+}
+
+//n pixels of row y of level s from column x, straight from the file for level 0
+static const uint32_t *mip_source(mip_pyramid *p, int s, int64_t y, int64_t x, int n, uint32_t *buf)
+{
+    if (s > 0)
+        return p->pixels[s] + y*p->w[s] + x;
+    p->convert(buf, p->file + y*p->stride + x*p->bytes, n);
+    return buf;
+}
+
+//average f by f blocks of level s into n pixels of row y, starting at column x0 of the level
+//they make. blocks at the right and bottom edges average what there is of them
+static void mip_box(mip_pyramid *p, int s, int f, int64_t y, int64_t x0, int n, uint32_t *out, mip_scratch *t)
+{
+    int64_t sy0 = y*f, sy1 = sy0 + f < p->h[s] ? sy0 + f : p->h[s];
+    int64_t sx0 = x0*f, sx1 = (x0 + n)*f < p->w[s] ? (x0 + n)*f : p->w[s];
+    int span = sx1 - sx0;
+
+    if (f == 1)
+    {
+        const uint32_t *src = mip_source(p, s, sy0, sx0, span, out);
+        if (src != out)
+            memcpy(out, src, span * sizeof(uint32_t));
+        return;
+    }
+
+    //up to 64 samples of 255 fit in 16 bits, so red and blue share a word and so do alpha
+    //and green
+    memset(t->rb, 0, n * sizeof(uint32_t));
+    memset(t->ag, 0, n * sizeof(uint32_t));
+    for (int64_t sy = sy0; sy < sy1; sy++)
+    {
+        const uint32_t *src = mip_source(p, s, sy, sx0, span, t->row);
+        for (int x = 0, i = 0; x < n; x++)
+            for (int k = 0; k < f && i < span; k++, i++)
+            {
+                t->rb[x] += src[i] & 0x00ff00ff;
+                t->ag[x] += src[i] >> 8 & 0x00ff00ff;
+            }
+    }
+    for (int x = 0; x < n; x++)
+    {
+        int64_t cols = sx1 - (sx0 + (int64_t) x*f);
+        uint32_t c = (sy1 - sy0) * (cols < f ? cols : f);
+        out[x] = 0xff000000u | ((t->rb[x] >> 16) / c) << 16 | ((t->ag[x] & 0xffff) / c) << 8
+                 | (t->rb[x] & 0xffff) / c;
+    }
+}
+
+//n pixels of row y of level z from column x0, black outside the image. picks the highest
+//level that is built far enough and within MIP_MAX_FACTOR of z, returns 0 if there is none yet
+int mip_row(mip_pyramid *p, int z, int64_t y, int64_t x0, int n, uint32_t *out, mip_scratch *t)
+{
+    for (int x = 0; x < n; x++)
+        out[x] = 0xff000000u;
+    if (y < 0 || y >= p->h[z] || x0 + n <= 0 || x0 >= p->w[z])
+        return 1;
+    int64_t from = x0 < 0 ? 0 : x0;
+    int64_t to = x0 + n < p->w[z] ? x0 + n : p->w[z];
+
+    for (int s = z; s >= 0 && s >= z - MIP_FIRST; s--)
+    {
+        int64_t need = (y + 1) << (z - s);
+        if (s > 0 && (s < MIP_FIRST || atomic_load_explicit(&p->rows_done[s], memory_order_acquire)
+                                       < (need < p->h[s] ? need : p->h[s])))
+            continue;
+        mip_box(p, s, 1 << (z - s), y, from, to - from, out + (from - x0), t);
+        return 1;
+    }
+    return 0;
+}
+
+int mip_done(mip_pyramid *p)
+{
+    int top = p->levels - 1;
+    return top < MIP_FIRST || atomic_load_explicit(&p->rows_done[top], memory_order_acquire) == p->h[top];
+}
+
+//build the kept levels, bottom up, until done or *stop
+void mip_build(mip_pyramid *p, volatile sig_atomic_t *stop)
+{
+    mip_scratch t;
+    if (p->levels <= MIP_FIRST || !mip_scratch_init(&t, p->w[MIP_FIRST]))
+        return;
+
+    //one pass through the file, let the kernel read ahead far and drop what is behind
+    madvise((void *) p->file, p->file_size, MADV_SEQUENTIAL);
+    for (int z = MIP_FIRST; z < p->levels && !*stop; z++)
+    {
+        int s = z == MIP_FIRST ? 0 : z - 1;
+        for (int64_t y = 0; y < p->h[z] && !*stop; y++)
+        {
+            mip_box(p, s, 1 << (z - s), y, 0, p->w[z], p->pixels[z] + y*p->w[z], &t);
+            atomic_store_explicit(&p->rows_done[z], y + 1, memory_order_release);
+        }
+        //from now on only the viewer reads the file, and mip_prefetch says what it will want
+        if (z == MIP_FIRST)
+            madvise((void *) p->file, p->file_size, MADV_RANDOM);
+    }
+    free(t.row);
+    free(t.rb);
+    free(t.ag);
+}
+
+//start reading file rows y0 to y1 in so scrolling there doesn't wait for the disk
+void mip_prefetch(mip_pyramid *p, int64_t y0, int64_t y1)
+{
+    y0 = y0 < 0 ? 0 : y0;
+    y1 = y1 < p->h[0] ? y1 : p->h[0];
+    if (y0 >= y1)
+        return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t from = y0*p->stride / page * page;
+    madvise((void *) (p->file + from), y1*p->stride - from, MADV_WILLNEED);
+}
+
+void mip_close(mip_pyramid *p)
+{
+    for (int z = MIP_FIRST; z < p->levels; z++)
+        if (p->pixels[z])
+            munmap(p->pixels[z], p->size[z]);
+    if (p->file)
+        munmap((void *) p->file, p->file_size);
+    memset(p, 0, sizeof(*p));
+}
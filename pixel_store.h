@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+//compact per pixel results for big renders, 4 bytes a pixel instead of the 16 of a value_depth.
+//structure of arrays: the depth as 16 bits, plus 8 more bits in a second array for budgets
+//of 65536 iterations or more, and the value quantised to 16 bits.
+//the palette only ever looks at value mod VALUE_PERIOD, so that is what gets kept
+
+#define VALUE_PERIOD 12.5
+#define VALUE_STEPS 65536
+#define MAX_STORE_ITERATIONS ((1 << 24) - 1)
+
+typedef struct {
+    size_t n;
+    uint16_t *depth;
+    uint8_t *depth_hi;      //NULL when every depth fits 16 bits
+    uint16_t *value;
+    double max_error;       //worst |stored - real| value mod VALUE_PERIOD seen by store_put
+} pixel_store;
+
+void store_free(pixel_store *s)
+{
+    free(s->depth);
+    free(s->depth_hi);
+    free(s->value);
+}
+
+//returns 0 when out of memory or the budget needs more than 24 bits
+int store_init(pixel_store *s, size_t n, int iterations)
+{
+    *s = (pixel_store) {.n = n};
+    if (iterations > MAX_STORE_ITERATIONS)
+        return 0;
+    s->depth = calloc(n, sizeof(*s->depth));
+    s->value = calloc(n, sizeof(*s->value));
+    if (iterations >= 1 << 16)
+        s->depth_hi = calloc(n, 1);
+    if (!s->depth || !s->value || (iterations >= 1 << 16 && !s->depth_hi))
+    {
+        store_free(s);
+        return 0;
+    }
+    return 1;
+}
+
+static inline double store_value(const pixel_store *s, size_t i)
+{
+    return (s->value[i] + 0.5) * (VALUE_PERIOD / VALUE_STEPS);
+}
+
+static inline int store_depth(const pixel_store *s, size_t i)
+{
+    return s->depth[i] | (s->depth_hi ? s->depth_hi[i] << 16 : 0);
+}
+
+static inline void store_put(pixel_store *s, size_t i, double value, int depth)
+{
+    double phase = fmod(value, VALUE_PERIOD);
+    if (phase < 0)
+        phase += VALUE_PERIOD;
+    int q = phase * (VALUE_STEPS / VALUE_PERIOD);
+    if (q >= VALUE_STEPS)
+        q = VALUE_STEPS - 1;
+
+    s->depth[i] = depth;
+    if (s->depth_hi)
+        s->depth_hi[i] = depth >> 16;
+    s->value[i] = q;
+
+    double err = fabs(store_value(s, i) - phase);
+    if (err > s->max_error)
+        s->max_error = err;
+}
+
+size_t store_bytes(const pixel_store *s)
+{
+    return s->n * (sizeof(*s->depth) + sizeof(*s->value) + (s->depth_hi ? 1 : 0));
+}
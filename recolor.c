@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include "libmandel.h"
+#include "dump_format.h"
+
+//colors a raw dump from coordinator -d without iterating anything again.
+//rows are split between threads, every pixel only depends on its own value and depth
+
+#define MAX_THREADS 64
+
+typedef void (*palette)(double v, int d, int iterations, unsigned char px[3]);
+
+dump_map dump;
+palette paint;
+unsigned char *image;
+int n_threads;
+
+//what mandel5 draws
+void mandel5_palette(double v, int d, int iterations, unsigned char px[3])
+{
+    shade_bytes(v, d, iterations, px);
+}
+
+//continuous escape count, the fractional part comes from how far past the bailout |z| got
+double smooth_depth(double v, int d)
+{
+    return v > 1 ? d + 1 - log2(log(v) / log(2)) : d;
+}
+
+//hue cycles with the continuous count, no banding
+void smooth_palette(double v, int d, int iterations, unsigned char px[3])
+{
+    if (d >= iterations)
+    {
+        px[0] = px[1] = px[2] = 0;
+        return;
+    }
+    double mu = smooth_depth(v, d);
+    hsv HSV = {fmod(mu * 8, 360), 0.8, 1};
+    put_rgb(hsv2rgb(HSV), px);
+}
+
+void gray_palette(double v, int d, int iterations, unsigned char px[3])
+{
+    if (d >= iterations)
+    {
+        px[0] = px[1] = px[2] = 0;
+        return;
+    }
+    double g = sqrt(fmax(smooth_depth(v, d), 0) / iterations);
+    px[0] = px[1] = px[2] = g >= 1 ? 255 : (int) (g*256);
+}
+
+struct {
+    const char *name;
+    palette paint;
+} palettes[] = {
+    {"mandel5", mandel5_palette},
+    {"smooth", smooth_palette},
+    {"gray", gray_palette},
+};
+
+void *paint_rows(void *arg)
+{
+    int id = (intptr_t) arg;
+    dump_header *h = dump.header;
+
+    for (size_t y = id; y < h->height; y += n_threads)
+        for (size_t x = 0; x < h->width; x++)
+        {
+            size_t i = y*h->width + x;
+            paint(dump.value[i], dump.depth[i], h->iterations, &image[3*i]);
+        }
+    return NULL;
+}
+
+void usage(void)
+{
+    printf("recolor [-p mandel5|smooth|gray] [-t threads] [-o out.ppm] dump.mdmp\n");
+}
+
+int main(int argc, char* argv[])
+{
+    const char *in = NULL, *out = "recolor.ppm";
+    n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    paint = mandel5_palette;
+
+    for (int i = 1; i<argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            in = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            usage();
+            return 1;
+        }
+        switch (argv[i][1])
+        {
+            case 'p':
+                paint = NULL;
+                for (size_t k = 0; k < sizeof(palettes)/sizeof(palettes[0]); k++)
+                    if (strcmp(argv[i+1], palettes[k].name) == 0)
+                        paint = palettes[k].paint;
+                break;
+            case 't': n_threads = atoi(argv[i+1]); break;
+            case 'o': out = argv[i+1]; break;
+            default: paint = NULL; break;
+        }
+        if (!paint)
+        {
+            usage();
+            return 1;
+        }
+        i++;
+    }
+    if (!in || n_threads <= 0)
+    {
+        usage();
+        return 1;
+    }
+    if (n_threads > MAX_THREADS)
+        n_threads = MAX_THREADS;
+
+    if (!dump_open(in, &dump))
+    {
+        fprintf(stderr, "%s: not a dump\n", in);
+        return 1;
+    }
+    dump_header *h = dump.header;
+    image = malloc((size_t) h->width*h->height*3);
+    if (!image)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_t threads[MAX_THREADS];
+    for (int i = 0; i < n_threads; i++)
+        pthread_create(&threads[i], NULL, paint_rows, (void *) (intptr_t) i);
+    for (int i = 0; i < n_threads; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    fprintf(stderr, "%ux%u colored in %.1f ms on %d threads\n", h->width, h->height,
+            (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6, n_threads);
+
+    FILE *f = fopen(out, "wb");
+    if (!f)
+    {
+        perror(out);
+        return 1;
+    }
+    fprintf(f, "P6\n%u %u\n255\n", h->width, h->height);
+    fwrite(image, 3, (size_t) h->width*h->height, f);
+    if (fclose(f) != 0)
+    {
+        perror(out);
+        return 1;
+    }
+    dump_close(&dump);
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include "shm_ring.h"
+
+//example producer for stdin-sdl -s: scrolls color bands through a ring as fast as it can
+//and prints how much it pushes. a real simulation writes its own frame where this fills bands,
+//in whichever format of frame_format.h its data already has
+
+volatile sig_atomic_t stop;
+
+void inthand(int signum) {
+    stop = 1;
+}
+
+double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+//row y of frame t, bands scroll down and fade from left to right
+void fill_row(uint8_t *row, int format, int cols, int y, uint64_t t)
+{
+    int v = (y + t) & 0xff;
+    switch (format)
+    {
+        case FMT_RGB332:
+            memset(row, v >> 3, cols);
+            break;
+
+        case FMT_GRAY8:
+        case FMT_YUV420:
+            memset(row, v, cols);
+            break;
+
+        case FMT_GRAY16:
+            for (int x = 0; x < cols; x++)
+            {
+                uint16_t g = (y + t) * 64;
+                memcpy(row + 2*x, &g, 2);
+            }
+            break;
+
+        default:
+        {
+            int bytes = frame_formats[format].bytes;
+            for (int x = 0; x < cols; x++)
+            {
+                uint8_t *px = row + x*bytes;
+                px[0] = v;
+                px[1] = x * 255 / cols;
+                px[2] = 255 - v;
+                if (bytes == 4)
+                    px[3] = 255;
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    ring r;
+    const char *name = argc > 1 ? argv[1] : "/stdin-sdl";
+    int cols = argc > 3 ? atoi(argv[2]) : 900;
+    int rows = argc > 3 ? atoi(argv[3]) : 700;
+    int format = argc > 4 ? format_by_name(argv[4]) : FMT_RGB332;
+    if (format < 0)
+    {
+        printf("formats: rgb332 gray8 gray16 rgb24 rgba32 yuv420\n");
+        return 1;
+    }
+    //rows start on a cache line, like a simulation that keeps its own buffers that way would
+    size_t stride = (min_stride(format, cols) + 63) & ~(size_t) 63;
+    size_t size = frame_bytes(format, rows, stride);
+
+    if (!ring_create(&r, name, cols, rows, format, stride, 4))
+    {
+        perror(name);
+        return 1;
+    }
+    printf("writing %dx%d %s frames to %s, run stdin-sdl -s %s\n", cols, rows,
+           frame_formats[format].name, name, name);
+    signal(SIGINT, inthand);
+
+    double last = now();
+    uint64_t frames = 0;
+    while (!stop)
+    {
+        uint8_t *px = ring_begin(&r);
+        uint64_t t = r.next;
+        for (int y = 0; y < rows; y++)
+            fill_row(px + y*stride, format, cols, y, t);
+        if (format == FMT_YUV420)
+            memset(px + stride*rows, 128, size - stride*rows);
+        ring_publish(&r);
+        frames++;
+
+        double t_now = now();
+        if (t_now - last >= 1)
+        {
+            printf("%.0f frames/s, %.0f MB/s\n", frames / (t_now - last),
+                   frames * (double) size / (t_now - last) / 1e6);
+            frames = 0;
+            last = t_now;
+        }
+    }
+    ring_close(&r);
+    shm_unlink(name);
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "frame_format.h"
+
+//shared memory ring of frames for stdin-sdl -s. a producer maps it, fills the next slot in
+//place and publishes it, the viewer maps the same memory and decodes the newest published
+//frame from its slot into a texture that is not on screen. nobody waits on anybody: frames
+//the viewer is too slow for are simply overwritten
+//
+//every slot has a sequence number, 2n+1 while frame n is being written into it and 2n+2 once
+//it is complete. a reader takes the newest frame only once its slot says 2n+2
+//(ring_newest), checks again after decoding (ring_still_valid) and only shows the texture if
+//it still does. otherwise the writer lapped it and the last good frame stays up
+//
+//frames are laid out like on stdin, in any of the formats of frame_format.h
+
+#define RING_MAGIC 0x474e4952   //"RING"
+#define RING_VERSION 2
+#define RING_MAX_SLOTS 16
+
+typedef struct {
+    uint32_t magic, version;
+    uint32_t cols, rows;
+    uint32_t format;                //enum frame_format
+    uint32_t stride;                //bytes from one row to the next
+    uint32_t slots;
+    uint32_t slot_size;             //frame_bytes rounded up to a cache line
+    uint64_t data_offset;           //of slot 0 from the start of the mapping
+    _Atomic uint64_t published;     //newest complete frame, 0 before the first
+    _Atomic uint64_t seq[RING_MAX_SLOTS];
+} ring_header;
+
+typedef struct {
+    ring_header *h;
+    uint8_t *data;
+    size_t size;
+    uint64_t next;                  //producer: frame being written
+} ring;
+
+static inline uint8_t *ring_slot(const ring *r, uint64_t frame)
+{
+    return r->data + (frame % r->h->slots) * r->h->slot_size;
+}
+
+//producer side, makes (or replaces) the shared memory object name, returns 0 on failure
+int ring_create(ring *r, const char *name, int cols, int rows, int format, size_t stride, int slots)
+{
+    if (cols <= 0 || rows <= 0 || format < 0 || format >= N_FORMATS
+            || stride < min_stride(format, cols) || slots < 2 || slots > RING_MAX_SLOTS)
+        return 0;
+    size_t slot_size = (frame_bytes(format, rows, stride) + 63) & ~(size_t) 63;
+    size_t offset = (sizeof(ring_header) + 4095) & ~(size_t) 4095;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return 0;
+    r->size = offset + slot_size * slots;
+    if (ftruncate(fd, r->size) < 0)
+    {
+        close(fd);
+        return 0;
+    }
+    r->h = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r->h == MAP_FAILED)
+        return 0;
+
+    //fresh pages are zero, so published and every seq already read as nothing written yet
+    r->h->cols = cols;
+    r->h->rows = rows;
+    r->h->format = format;
+    r->h->stride = stride;
+    r->h->slots = slots;
+    r->h->slot_size = slot_size;
+    r->h->data_offset = offset;
+    r->h->version = RING_VERSION;
+    atomic_store_explicit((_Atomic uint32_t *) &r->h->magic, RING_MAGIC, memory_order_release);
+    r->data = (uint8_t *) r->h + offset;
+    r->next = 0;
+    return 1;
+}
+
+//start the next frame, write frame_bytes of it to what comes back and then ring_publish
+uint8_t *ring_begin(ring *r)
+{
+    uint64_t n = ++r->next;
+    atomic_store_explicit(&r->h->seq[n % r->h->slots], 2*n + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return ring_slot(r, n);
+}
+
+void ring_publish(ring *r)
+{
+    uint64_t n = r->next;
+    atomic_store_explicit(&r->h->seq[n % r->h->slots], 2*n + 2, memory_order_release);
+    atomic_store_explicit(&r->h->published, n, memory_order_release);
+}
+
+//viewer side, maps an existing ring, returns 0 if it is missing or not a ring
+int ring_open(ring *r, const char *name)
+{
+    struct stat st;
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(ring_header))
+    {
+        close(fd);
+        return 0;
+    }
+    r->size = st.st_size;
+    r->h = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r->h == MAP_FAILED)
+        return 0;
+
+    ring_header *h = r->h;
+    if (atomic_load_explicit((_Atomic uint32_t *) &h->magic, memory_order_acquire) != RING_MAGIC
+            || h->version != RING_VERSION || h->slots < 2 || h->slots > RING_MAX_SLOTS
+            || h->format >= N_FORMATS || h->stride < min_stride(h->format, h->cols)
+            || h->data_offset + (uint64_t) h->slot_size * h->slots > r->size
+            || h->slot_size < frame_bytes(h->format, h->rows, h->stride))
+    {
+        munmap(r->h, r->size);
+        return 0;
+    }
+    r->data = (uint8_t *) h + h->data_offset;
+    return 1;
+}
+
+//newest complete frame number and its pixels, 0 if nothing has been published yet.
+//the pixels can be overwritten at any time, check ring_still_valid after using them
+uint64_t ring_newest(const ring *r, const uint8_t **pixels)
+{
+    uint64_t n = atomic_load_explicit(&r->h->published, memory_order_acquire);
+    if (n == 0 || atomic_load_explicit(&r->h->seq[n % r->h->slots], memory_order_acquire) != 2*n + 2)
+        return 0;
+    *pixels = ring_slot(r, n);
+    return n;
+}
+
+int ring_still_valid(const ring *r, uint64_t n)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&r->h->seq[n % r->h->slots], memory_order_relaxed) == 2*n + 2;
+}
+
+void ring_close(ring *r)
+{
+    munmap(r->h, r->size);
+}
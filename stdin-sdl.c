@@ -6,12 +6,18 @@
 
 #include <unistd.h>
 #include <signal.h>
+#include <errno.h>
+#include "shm_ring.h"
+#include "mip_pyramid.h"
 
 #define WIDTH 900
 //640
 #define HEIGHT 700
 //480
 
+//stdin is read this much at a time in breakmode, where rows end at newlines
+#define READ_CHUNK (1 << 16)
+
 
 volatile sig_atomic_t stop;
 
@@ -19,12 +25,319 @@ void inthand(int signum) {
     stop = 1;
 }
 
+int breakmode = 0;
+int pxp = 1;
+int cols, rows;         //big pixels per frame
+int format = FMT_RGB332;//frame_format.h, -f
+size_t stride;          //bytes from one row of a frame to the next, -S
+size_t frame_size;
 
-int main(int argc, char* argv[])
+//the reader thread reads a whole frame into one buffer while the other is being shown
+uint8_t *frames[2];
+int filled = -1;        //frame read and waiting for the display, -1 for none
+int uploading = -1;     //frame the display is copying into the texture
+SDL_mutex *lock;
+SDL_cond *changed;
+
+//-s name shows frames from a shared memory ring (shm_ring.h) instead of stdin
+const char *shm_name = NULL;
+ring shm;
+uint64_t ring_shown, ring_frames, ring_dropped, ring_torn;
+SDL_Texture *ring_back;     //decoded into while the other texture is on screen
+
+//-m file shows a file as one tall image, scrolled and zoomed out with the keys. view_x and
+//view_y are the file pixel in the top left corner, a shown pixel averages 2^zoom by 2^zoom
+const char *file_name = NULL;
+mip_pyramid pyr;
+mip_scratch view_scratch;
+int64_t view_x, view_y;
+int zoom;
+int view_changed = 1;
+
+unsigned char inbuf[READ_CHUNK];
+size_t in_pos, in_len;
+
+//formats SDL can show take the frame as is and the renderer converts, the rest go through
+//the converters of frame_format.h into ARGB8888 rows
+static const Uint32 texture_format[N_FORMATS] = {
+    [FMT_RGB332] = SDL_PIXELFORMAT_ARGB8888,
+    [FMT_GRAY8] = SDL_PIXELFORMAT_ARGB8888,
+    [FMT_GRAY16] = SDL_PIXELFORMAT_ARGB8888,
+    [FMT_RGB24] = SDL_PIXELFORMAT_RGB24,
+    [FMT_RGBA32] = SDL_PIXELFORMAT_RGBA32,
+    [FMT_YUV420] = SDL_PIXELFORMAT_IYUV,
+};
+
+//put one frame of the current format and geometry into the texture
+void upload_frame(SDL_Texture *texture, const uint8_t *src)
+{
+    switch (format)
+    {
+        case FMT_RGB24:
+        case FMT_RGBA32:
+            SDL_UpdateTexture(texture, NULL, src, stride);
+            return;
+
+        case FMT_YUV420:
+        {
+            size_t cs = chroma_stride(stride);
+            const uint8_t *u = src + stride*rows;
+            const uint8_t *v = u + cs*((rows + 1) / 2);
+            SDL_UpdateYUVTexture(texture, NULL, src, stride, u, cs, v, cs);
+            return;
+        }
+    }
+    row_converter convert = format_converter(format);
+
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(texture, NULL, &pixels, &pitch) < 0)
+        return;
+    for (int y = 0; y < rows; y++)
+        convert((Uint32 *) ((Uint8 *) pixels + y*pitch), src + y*stride, cols);
+    SDL_UnlockTexture(texture);
+}
+
+//next byte of stdin, EOF at the end
+int next_byte(void)
+{
+    if (in_pos == in_len)
+    {
+        ssize_t got;
+        do
+            got = read(0, inbuf, sizeof(inbuf));
+        while (got < 0 && errno == EINTR);
+        if (got <= 0)
+            return EOF;
+        in_pos = 0;
+        in_len = got;
+    }
+    return inbuf[in_pos++];
+}
+
+//read one frame as it comes, returns how many bytes of it arrived before stdin ran out
+size_t read_frame(uint8_t *out)
+{
+    size_t got = 0;
+
+    if (breakmode)
+    {
+        //a newline ends the row early, the rest of it shows up in the rgb332 color
+        //closest to cyan
+        for (int y = 0; y < rows; y++)
+            for (int x = 0; x < cols; x++)
+            {
+                int ch = next_byte();
+                if (ch == EOF)
+                    return got;
+                if (ch == '\n')
+                {
+                    memset(out + y*stride + x, 0xf8, cols - x);
+                    break;
+                }
+                out[y*stride + x] = ch;
+                got = y*stride + x + 1;
+            }
+        return frame_size;
+    }
+
+    while (got < frame_size)
+    {
+        ssize_t r = read(0, out + got, frame_size - got);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        got += r;
+    }
+    return got;
+}
+
+//black out what a short frame is missing, zero chroma is green so that gets the middle value
+void blank_rest(uint8_t *frame, size_t got)
+{
+    size_t luma = stride*rows;
+    memset(frame + got, 0, frame_size - got);
+    if (format == FMT_YUV420 && got < frame_size)
+    {
+        size_t from = got > luma ? got : luma;
+        memset(frame + from, 128, frame_size - from);
+    }
+}
+
+//take the frame the reader thread finished, if any, 1 if there was one.
+//waits a little for it so events still get handled when stdin is slow
+int show_stdin(SDL_Texture *texture)
+{
+    SDL_LockMutex(lock);
+    if (filled < 0)
+        SDL_CondWaitTimeout(changed, lock, 10);
+    int show = filled;
+    if (show >= 0)
+    {
+        uploading = show;
+        filled = -1;
+    }
+    SDL_UnlockMutex(lock);
+    if (show < 0)
+        return 0;
+
+    upload_frame(texture, frames[show]);
+    SDL_LockMutex(lock);
+    uploading = -1;
+    SDL_CondBroadcast(changed);
+    SDL_UnlockMutex(lock);
+    return 1;
+}
+
+//decode the newest frame of the ring straight from its slot into ring_back, 1 if there was
+//a new one and *texture is now it. a frame the producer overwrote halfway stays in ring_back,
+//the last good one is still shown and the next frame replaces the torn one
+int show_ring(SDL_Texture **texture)
+{
+    const uint8_t *src;
+    uint64_t n = ring_newest(&shm, &src);
+    if (n == 0 || n == ring_shown)
+        return 0;
+
+    upload_frame(ring_back, src);
+    if (!ring_still_valid(&shm, n))
+    {
+        ring_torn++;
+        return 0;
+    }
+    SDL_Texture *t = *texture;
+    *texture = ring_back;
+    ring_back = t;
+    if (ring_shown && n > ring_shown + 1)
+        ring_dropped += n - ring_shown - 1;
+    ring_shown = n;
+    ring_frames++;
+    return 1;
+}
+
+//draw the part of the file in view when it moved, and every so often while the overviews
+//are still being built so they fill in
+int show_file(SDL_Window *window, SDL_Texture *texture)
+{
+    static Uint32 last;
+    if (!view_changed && (mip_done(&pyr) || SDL_GetTicks() - last < 100))
+        return 0;
+    view_changed = 0;
+    last = SDL_GetTicks();
+
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(texture, NULL, &pixels, &pitch) < 0)
+        return 0;
+    for (int y = 0; y < rows; y++)
+    {
+        Uint32 *row = (Uint32 *) ((Uint8 *) pixels + y*pitch);
+        //gray where the overview isn't there yet
+        if (!mip_row(&pyr, zoom, (view_y >> zoom) + y, view_x >> zoom, cols, row, &view_scratch))
+            for (int x = 0; x < cols; x++)
+                row[x] = 0xff404040u;
+    }
+    SDL_UnlockTexture(texture);
+
+    //close up the view comes from the file itself, have the screens around it read in
+    if (zoom < MIP_FIRST)
+    {
+        int64_t screen = (int64_t) rows << zoom;
+        mip_prefetch(&pyr, view_y - screen, view_y + 2*screen);
+    }
+
+    char title[128];
+    snprintf(title, sizeof(title), "%s  0x%llx of 0x%llx  1:%d", file_name,
+             (unsigned long long) (view_y*pyr.stride + view_x*pyr.bytes),
+             (unsigned long long) pyr.file_size, 1 << zoom);
+    SDL_SetWindowTitle(window, title);
+    return 1;
+}
+
+//arrows scroll an eighth of the view, page up and down a whole one, home and end go to the
+//ends of the file and 0 to 9 to tenths of it. - zooms out, = zooms in
+void move_view(SDL_Keycode key)
+{
+    int64_t view_w = (int64_t) cols << zoom, view_h = (int64_t) rows << zoom;
+    int64_t center_x = view_x + view_w/2, center_y = view_y + view_h/2;
+
+    switch (key)
+    {
+        case SDLK_UP: view_y -= view_h/8; break;
+        case SDLK_DOWN: view_y += view_h/8; break;
+        case SDLK_LEFT: view_x -= view_w/8; break;
+        case SDLK_RIGHT: view_x += view_w/8; break;
+        case SDLK_PAGEUP: view_y -= view_h; break;
+        case SDLK_PAGEDOWN: view_y += view_h; break;
+        case SDLK_HOME: view_y = 0; break;
+        case SDLK_END: view_y = pyr.h[0]; break;
+
+        case SDLK_MINUS:
+        case SDLK_EQUALS:
+            zoom += key == SDLK_MINUS ? 1 : -1;
+            zoom = zoom < 0 ? 0 : zoom >= pyr.levels ? pyr.levels - 1 : zoom;
+            view_w = (int64_t) cols << zoom;
+            view_h = (int64_t) rows << zoom;
+            view_x = center_x - view_w/2;
+            view_y = center_y - view_h/2;
+            break;
+
+        default:
+            if (key < '0' || key > '9')
+                return;
+            view_y = pyr.h[0] * (key - '0') / 10;
+    }
+
+    int64_t max_x = pyr.w[0] - view_w, max_y = pyr.h[0] - view_h;
+    view_x = view_x > max_x ? max_x : view_x;
+    view_y = view_y > max_y ? max_y : view_y;
+    view_x = view_x < 0 ? 0 : view_x;
+    view_y = view_y < 0 ? 0 : view_y;
+    view_changed = 1;
+}
+
+int build_mips(void *arg)
+{
+    mip_build(&pyr, &stop);
+    return 0;
+}
+
+int reader(void *arg)
 {
+    int back = 0;
+
+    while (!stop)
+    {
+        SDL_LockMutex(lock);
+        while (!stop && (uploading == back || filled == back))
+            SDL_CondWait(changed, lock);
+        SDL_UnlockMutex(lock);
 
-    int breakmode = 0;
-    int pxp = 1;
+        size_t got = read_frame(frames[back]);
+        blank_rest(frames[back], got);
+
+        SDL_LockMutex(lock);
+        while (!stop && filled >= 0)
+            SDL_CondWait(changed, lock);
+        filled = back;
+        SDL_CondBroadcast(changed);
+        SDL_UnlockMutex(lock);
+
+        if (got < frame_size)
+        {
+            printf("No more\n");
+            break;
+        }
+        back ^= 1;
+    }
+    return 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    int width = 0, height = 0;
 
     for (int i = 1; i<argc; i++)
     {
@@ -47,6 +360,37 @@ int main(int argc, char* argv[])
                     printf("big pix n = %d!\n", pxp);
                     break;
 
+                case 's':
+                    shm_name = argv[++i];
+                    printf("shared memory %s!\n", shm_name);
+                    break;
+
+                case 'W':
+                    width = atoi(argv[++i]);
+                    break;
+
+                case 'H':
+                    height = atoi(argv[++i]);
+                    break;
+
+                case 'S':
+                    stride = strtoul(argv[++i], NULL, 10);
+                    break;
+
+                case 'm':
+                    file_name = argv[++i];
+                    printf("file %s!\n", file_name);
+                    break;
+
+                case 'f':
+                    format = format_by_name(argv[++i]);
+                    if (format < 0)
+                    {
+                        printf("formats: rgb332 gray8 gray16 rgb24 rgba32 yuv420\n");
+                        return EXIT_FAILURE;
+                    }
+                    break;
+
                 default:
                     printf("Not recorgnized\n");
             }
@@ -55,24 +399,107 @@ int main(int argc, char* argv[])
             printf("Super not recognized\n");
         }
     }
+    if (pxp < 1)
+        pxp = 1;
+    //-W and -H give the frame size in big pixels, otherwise the frame fills the window
+    cols = width > 0 ? width : (WIDTH + pxp - 1) / pxp;
+    rows = height > 0 ? height : (HEIGHT + pxp - 1) / pxp;
+    if (shm_name)
+    {
+        //the producer decides the frame size and layout
+        if (!ring_open(&shm, shm_name))
+        {
+            printf("no ring called %s\n", shm_name);
+            return EXIT_FAILURE;
+        }
+        cols = width = shm.h->cols;
+        rows = height = shm.h->rows;
+        format = shm.h->format;
+        stride = shm.h->stride;
+    }
+    if (stride == 0)
+        stride = min_stride(format, cols);
+    if (stride < min_stride(format, cols))
+    {
+        printf("stride %zu is less than a row of %s, %zu\n", stride, frame_formats[format].name,
+               min_stride(format, cols));
+        return EXIT_FAILURE;
+    }
+    if (breakmode && format != FMT_RGB332)
+    {
+        printf("breakmode only works with rgb332\n");
+        return EXIT_FAILURE;
+    }
+    frame_size = frame_bytes(format, rows, stride);
+
+    if (file_name)
+    {
+        //the frame size so far was the file's, the view fills the window
+        int file_width = cols;
+        cols = (WIDTH + pxp - 1) / pxp;
+        rows = (HEIGHT + pxp - 1) / pxp;
+        width = height = 0;
+        if (!format_converter(format))
+        {
+            printf("files can't be shown as %s\n", frame_formats[format].name);
+            return EXIT_FAILURE;
+        }
+        if (!mip_open(&pyr, file_name, file_width, stride, format) || !mip_scratch_init(&view_scratch, cols))
+        {
+            printf("can't show %s\n", file_name);
+            return EXIT_FAILURE;
+        }
+    }
+    else if (!shm_name)
+    {
+        frames[0] = malloc(frame_size);
+        frames[1] = malloc(frame_size);
+    }
+    if (!shm_name && !file_name && (!frames[0] || !frames[1]))
+    {
+        printf("out of memory\n");
+        return EXIT_FAILURE;
+    }
 
 
     SDL_Event event;
-    
+
     SDL_Window *window;
     SDL_Renderer *renderer;
-    SDL_CreateWindowAndRenderer(WIDTH, HEIGHT, 0, &window, &renderer);
+    SDL_Texture *texture;
+    //one frame per refresh, and big pixels stay sharp when the texture is stretched
+    SDL_SetHint(SDL_HINT_RENDER_VSYNC, "1");
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+    SDL_CreateWindowAndRenderer(width > 0 ? cols*pxp : WIDTH, height > 0 ? rows*pxp : HEIGHT, 0,
+                                &window, &renderer);
+    texture = SDL_CreateTexture(renderer, file_name ? SDL_PIXELFORMAT_ARGB8888 : texture_format[format],
+                                SDL_TEXTUREACCESS_STREAMING, cols, rows);
+    //rgba32 frames are shown opaque, whatever their alpha says
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE);
+    if (shm_name)
+    {
+        ring_back = SDL_CreateTexture(renderer, texture_format[format], SDL_TEXTUREACCESS_STREAMING, cols, rows);
+        SDL_SetTextureBlendMode(ring_back, SDL_BLENDMODE_NONE);
+    }
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderClear(renderer);
     int * crash = NULL;
     signal(SIGINT, inthand);
-    
 
+    lock = SDL_CreateMutex();
+    changed = SDL_CreateCond();
+    SDL_Thread *mip_thread = NULL;
+    if (file_name)
+        mip_thread = SDL_CreateThread(build_mips, "mip builder", NULL);
+    else if (!shm_name)
+        SDL_CreateThread(reader, "stdin reader", NULL);
+
+    SDL_Rect dst = {0, 0, cols*pxp, rows*pxp};
     int quit = 0;
-    int nomore = 0;
-    int i = 0;
-    while (!stop)
+    while (!stop && !quit)
     {
-        if (1 || SDL_PollEvent(&event))
+        int redraw = 0;
+        while (SDL_PollEvent(&event))
         {
 
             switch(event.type) {
@@ -80,69 +507,70 @@ int main(int argc, char* argv[])
                     quit = 1;
                     break;
 
-                case SDL_MOUSEMOTION:
-                    //....
+                case SDL_WINDOWEVENT:
+                    redraw = 1;
                     break;
 
                 case SDL_KEYDOWN:
                     switch(event.key.keysym.sym) {
-                        case SDLK_ESCAPE: 
+                        case SDLK_ESCAPE:
                             quit = 1;
                             break;
                             // cases for other keypresses
                         case SDL_SCANCODE_D:
                             *crash = 1;
                             break; // never run
+
+                        default:
+                            if (file_name)
+                                move_view(event.key.keysym.sym);
                     }
                     break;
+
+                case SDL_MOUSEWHEEL:
+                    if (file_name)
+                        move_view(event.wheel.y > 0 ? SDLK_UP : SDLK_DOWN);
+                    break;
                     // cases for other events
             }
         }
 
-        SDL_Delay(50);
-        if (nomore) continue;
-        SDL_RenderClear(renderer);
+        int shown;
+        if (file_name)
+            shown = show_file(window, texture);
+        else if (shm_name)
+            shown = show_ring(&texture);
+        else
+            shown = show_stdin(texture);
+        if (shown)
+            redraw = 1;
+        else if (shm_name || file_name)
+            SDL_Delay(1);
 
-
-        for (int y = 0; y < HEIGHT && !nomore; y+=pxp)
+        if (redraw)
         {
-            for (int x = 0; x < WIDTH && !nomore; x+=pxp)
-            {
-                unsigned int ch = getchar();
-                if (ch == EOF)
-                {
-                    nomore = 1;
-                    printf("No more\n");
-                    break;
-                }
-                if (breakmode && ch == '\n')
-                {
-                    SDL_SetRenderDrawColor(renderer, 0, 255, 255, 255);
-                    break;
-                }
-                int rgb[3];
-                rgb[0] = (0b111 & ch) * 32;
-                rgb[1] = (0b111 & (ch >> 3)) * 32;
-                rgb[2] = (0b11 & (ch >> 6)) * 32;
-                int remaineder = (ch >> 8);
-                SDL_SetRenderDrawColor(renderer, rgb[0], rgb[1], rgb[2], 255);
-
-                if (pxp == 1)
-                {
-                    SDL_RenderDrawPoint(renderer, x, y);
-                } else
-                {
-                    for (int y2 = 0; y2 < pxp; y2++)
-                        for (int x2 = 0; x2 < pxp && !nomore; x2++)
-                            SDL_RenderDrawPoint(renderer, x+x2, y+y2);
-                }
-            }
+            SDL_RenderClear(renderer);
+            SDL_RenderCopy(renderer, texture, NULL, &dst);
+            SDL_RenderPresent(renderer);
         }
-        SDL_RenderPresent(renderer);
     }
 
-
-
+    //the reader may be stuck in read(), it goes away with the process. the mip builder looks at
+    //stop every row and has to be out of the levels before they are unmapped
+    stop = 1;
+    if (mip_thread)
+        SDL_WaitThread(mip_thread, NULL);
+    if (shm_name)
+    {
+        printf("%llu frames shown, %llu dropped, %llu torn\n", (unsigned long long) ring_frames,
+               (unsigned long long) ring_dropped, (unsigned long long) ring_torn);
+        ring_close(&shm);
+    }
+    if (file_name)
+        mip_close(&pyr);
+    SDL_DestroyTexture(texture);
+    if (ring_back)
+        SDL_DestroyTexture(ring_back);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -0,0 +1,165 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "libmandel.h"
+
+//wire format between coordinator.c and mandel5 -w tile workers. everything is little endian
+//and fixed size so a worker can just as well sit on the other end of an ssh pipe
+//
+//request  (TILE_REQUEST_SIZE bytes)
+//    u32 magic, u32 id, i32 func,
+//    f64 julia_root real, im, f64 center real, im, f64 center_lo real, im, f64 zoom,
+//    i32 iterations, i32 smoothing, i32 image width, height, i32 tile x0, y0, w, h
+//response (TILE_RESPONSE_HEADER + w*h*TILE_PIXEL_SIZE bytes)
+//    u32 magic, u32 id, i32 w, i32 h, then per pixel row by row: f64 value, i32 depth
+//
+//pixel X Y of a width x height image is the point (X - width/2)/zoom - center, the mapping
+//of a mandel_view in libmandel.h
+
+#define TILE_MAGIC 0x444e414d   //"MAND"
+#define TILE_REQUEST_SIZE 100
+#define TILE_RESPONSE_HEADER 16
+#define TILE_PIXEL_SIZE 12
+#define TILE_MAX_IMAGE (1 << 20)   //widest and tallest image a request can be part of
+#define TILE_MAX_SIDE 4096         //widest and tallest tile
+
+typedef struct {
+    uint32_t id;
+    int32_t func;
+    double root_real, root_im;
+    double center_real, center_im;
+    double center_lo_real, center_lo_im;
+    double zoom;
+    int32_t iterations;
+    int32_t smoothing;
+    int32_t width, height;
+    int32_t x0, y0, w, h;
+} tile_request;
+
+static inline void put_u32(uint8_t **p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        *(*p)++ = v >> (8*i);
+}
+
+static inline void put_f64(uint8_t **p, double d)
+{
+    uint64_t v;
+    memcpy(&v, &d, 8);
+    for (int i = 0; i < 8; i++)
+        *(*p)++ = v >> (8*i);
+}
+
+static inline uint32_t get_u32(const uint8_t **p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++)
+        v |= (uint32_t) *(*p)++ << (8*i);
+    return v;
+}
+
+static inline double get_f64(const uint8_t **p)
+{
+    uint64_t v = 0;
+    double d;
+    for (int i = 0; i < 8; i++)
+        v |= (uint64_t) *(*p)++ << (8*i);
+    memcpy(&d, &v, 8);
+    return d;
+}
+
+void encode_request(const tile_request *rq, uint8_t *buf)
+{
+    uint8_t *p = buf;
+    put_u32(&p, TILE_MAGIC);
+    put_u32(&p, rq->id);
+    put_u32(&p, rq->func);
+    put_f64(&p, rq->root_real);
+    put_f64(&p, rq->root_im);
+    put_f64(&p, rq->center_real);
+    put_f64(&p, rq->center_im);
+    put_f64(&p, rq->center_lo_real);
+    put_f64(&p, rq->center_lo_im);
+    put_f64(&p, rq->zoom);
+    put_u32(&p, rq->iterations);
+    put_u32(&p, rq->smoothing);
+    put_u32(&p, rq->width);
+    put_u32(&p, rq->height);
+    put_u32(&p, rq->x0);
+    put_u32(&p, rq->y0);
+    put_u32(&p, rq->w);
+    put_u32(&p, rq->h);
+}
+
+//returns 0 if the magic is wrong or the request is not a tile a worker can render
+int decode_request(const uint8_t *buf, tile_request *rq)
+{
+    const uint8_t *p = buf;
+    if (get_u32(&p) != TILE_MAGIC)
+        return 0;
+    rq->id = get_u32(&p);
+    rq->func = get_u32(&p);
+    rq->root_real = get_f64(&p);
+    rq->root_im = get_f64(&p);
+    rq->center_real = get_f64(&p);
+    rq->center_im = get_f64(&p);
+    rq->center_lo_real = get_f64(&p);
+    rq->center_lo_im = get_f64(&p);
+    rq->zoom = get_f64(&p);
+    rq->iterations = get_u32(&p);
+    rq->smoothing = get_u32(&p);
+    rq->width = get_u32(&p);
+    rq->height = get_u32(&p);
+    rq->x0 = get_u32(&p);
+    rq->y0 = get_u32(&p);
+    rq->w = get_u32(&p);
+    rq->h = get_u32(&p);
+    return rq->func >= MANDEL && rq->func <= SINKING_SHIP && rq->iterations > 0
+           && rq->width > 0 && rq->width <= TILE_MAX_IMAGE && rq->height > 0 && rq->height <= TILE_MAX_IMAGE
+           && rq->w > 0 && rq->w <= TILE_MAX_SIDE && rq->h > 0 && rq->h <= TILE_MAX_SIDE
+           && rq->x0 >= 0 && rq->x0 <= rq->width - rq->w && rq->y0 >= 0 && rq->y0 <= rq->height - rq->h;
+}
+
+//the view a request is a tile of, precision still to be settled with mandel_prepare
+mandel_view request_view(const tile_request *rq)
+{
+    return (mandel_view) {.func = rq->func, .julia_root = {rq->root_real, rq->root_im},
+                          .center = {rq->center_real, rq->center_im},
+                          .center_lo = {rq->center_lo_real, rq->center_lo_im}, .zoom = rq->zoom,
+                          .iterations = rq->iterations, .smoothing = rq->smoothing,
+                          .width = rq->width, .height = rq->height, .precision = PREC_DOUBLE};
+}
+
+//read or write exactly n bytes, returns 0 on eof or error
+int read_full(int fd, void *buf, size_t n)
+{
+    uint8_t *p = buf;
+    while (n > 0)
+    {
+        ssize_t got = read(fd, p, n);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return 0;
+        p += got;
+        n -= got;
+    }
+    return 1;
+}
+
+int write_full(int fd, const void *buf, size_t n)
+{
+    const uint8_t *p = buf;
+    while (n > 0)
+    {
+        ssize_t put = write(fd, p, n);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put <= 0)
+            return 0;
+        p += put;
+        n -= put;
+    }
+    return 1;
+}
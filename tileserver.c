@@ -0,0 +1,679 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "libmandel.h"
+#include "tile_protocol.h"
+
+//long running server for slippy map style browsing. answers
+//    GET /func/z/x/y.bmp?r=re,im&i=iterations
+//over http on localhost (or a unix socket with -u) with 256x256 bmp tiles.
+//z 0 is the square from -2-2i to 2+2i, every z level splits each tile in four.
+//pixels come from mandel5 -w worker processes, one render thread per worker, or with -w -
+//from the render threads themselves through libmandel.h.
+//identical requests in flight share one render and finished tiles stay in an lru cache
+
+#define TILE_PX 256
+#define MAX_Z 52                //x + 0.5 still fits a double exactly
+#define MAX_RENDERERS 256
+#define HASH_SIZE 65536
+#define LATENCY_SAMPLES 8192
+#define REPORT_SECONDS 5
+#define BMP_HEADER 54
+#define BMP_SIZE (BMP_HEADER + TILE_PX*TILE_PX*3)
+
+typedef struct {
+    int func;
+    int z;
+    uint64_t x, y;
+    double root_real, root_im;
+    int iterations;
+} tile_key;
+
+typedef struct entry {
+    tile_key key;
+    uint8_t *bmp;               //NULL until rendered
+    int failed;
+    int refs;                   //connections waiting on or sending this tile
+    int cached;                 //still reachable from the hash table
+    struct entry *hnext;        //hash chain
+    struct entry *newer, *older;//lru list, finished tiles only
+    struct entry *qnext;        //render queue
+} entry;
+
+pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t tile_done = PTHREAD_COND_INITIALIZER;
+pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+entry *table[HASH_SIZE];
+entry *newest, *oldest;
+entry *queue, *queue_tail;      //oldest request first so none of them starves
+size_t cache_bytes, cache_limit = 256 << 20;
+
+const char *worker_cmd = "./mandel5 -w";
+int in_process = 0;             //-w -
+int default_iterations = 500;
+
+//stats, under stats_lock. the counters only grow, everyone reading them keeps a snapshot
+typedef struct {
+    double when;
+    unsigned requests, hits, shared, renders;
+    unsigned n_latency;
+} counters;
+
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+double latency[LATENCY_SAMPLES];
+counters total;
+double started;
+
+double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+unsigned hash_key(const tile_key *k)
+{
+    uint64_t h = 1469598103934665603ull;
+    uint64_t parts[5];
+    parts[0] = k->func | (uint64_t) k->z << 8 | (uint64_t) k->iterations << 16;
+    parts[1] = k->x;
+    parts[2] = k->y;
+    memcpy(&parts[3], &k->root_real, 8);
+    memcpy(&parts[4], &k->root_im, 8);
+    for (int i = 0; i < 5; i++)
+    {
+        h ^= parts[i];
+        h *= 1099511628211ull;
+        h ^= h >> 29;
+    }
+    return h % HASH_SIZE;
+}
+
+int same_key(const tile_key *a, const tile_key *b)
+{
+    return a->func == b->func && a->z == b->z && a->x == b->x && a->y == b->y &&
+           a->root_real == b->root_real && a->root_im == b->root_im && a->iterations == b->iterations;
+}
+
+void unlink_lru(entry *e)
+{
+    if (e->newer) e->newer->older = e->older; else newest = e->older;
+    if (e->older) e->older->newer = e->newer; else oldest = e->newer;
+    e->newer = e->older = NULL;
+}
+
+void push_lru(entry *e)
+{
+    e->older = newest;
+    e->newer = NULL;
+    if (newest) newest->newer = e; else oldest = e;
+    newest = e;
+}
+
+void unhash(entry *e)
+{
+    entry **p = &table[hash_key(&e->key)];
+    while (*p != e)
+        p = &(*p)->hnext;
+    *p = e->hnext;
+    e->cached = 0;
+}
+
+void free_entry(entry *e)
+{
+    free(e->bmp);
+    free(e);
+}
+
+//drop least recently used tiles past the limit, ones still being sent go when the last sender lets go
+void evict(void)
+{
+    while (cache_bytes > cache_limit && oldest)
+    {
+        entry *e = oldest;
+        unlink_lru(e);
+        unhash(e);
+        cache_bytes -= BMP_SIZE;
+        if (e->refs == 0)
+            free_entry(e);
+    }
+}
+
+//returns the finished (or failed) tile with a reference held, rendering it if nobody has yet
+entry *get_tile(const tile_key *k)
+{
+    unsigned h = hash_key(k);
+    pthread_mutex_lock(&cache_lock);
+
+    entry *e = table[h];
+    while (e && !same_key(&e->key, k))
+        e = e->hnext;
+
+    int hit = e && e->bmp, joined = e && !e->bmp;
+    if (hit)
+    {
+        unlink_lru(e);
+        push_lru(e);
+    }
+    else if (!e)
+    {
+        e = calloc(1, sizeof(*e));
+        if (!e)
+        {
+            pthread_mutex_unlock(&cache_lock);
+            return NULL;
+        }
+        e->key = *k;
+        e->cached = 1;
+        e->hnext = table[h];
+        table[h] = e;
+        if (queue_tail) queue_tail->qnext = e; else queue = e;
+        queue_tail = e;
+        pthread_cond_signal(&queued);
+    }
+    e->refs++;
+    while (!e->bmp && !e->failed)
+        pthread_cond_wait(&tile_done, &cache_lock);
+    pthread_mutex_unlock(&cache_lock);
+
+    pthread_mutex_lock(&stats_lock);
+    total.hits += hit;
+    total.shared += joined;
+    pthread_mutex_unlock(&stats_lock);
+    return e;
+}
+
+void release(entry *e)
+{
+    pthread_mutex_lock(&cache_lock);
+    if (--e->refs == 0 && !e->cached)
+        free_entry(e);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// ===================================
+// rendering
+// ===================================
+typedef struct {
+    pid_t pid;
+    int to, from;
+} worker;
+
+int spawn(worker *w)
+{
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) < 0 || pipe2(out, O_CLOEXEC) < 0)
+        return 0;
+
+    w->pid = fork();
+    if (w->pid < 0)
+        return 0;
+    //its own process group, so bury reaches whatever the shell started and not just sh
+    if (w->pid == 0)
+    {
+        setpgid(0, 0);
+        dup2(in[0], 0);
+        dup2(out[1], 1);
+        execl("/bin/sh", "sh", "-c", worker_cmd, (char *) NULL);
+        _exit(127);
+    }
+    setpgid(w->pid, w->pid);
+
+    close(in[0]);
+    close(out[1]);
+    w->to = in[1];
+    w->from = out[0];
+    return 1;
+}
+
+void bury(worker *w)
+{
+    close(w->to);
+    close(w->from);
+    kill(-w->pid, SIGTERM);
+    waitpid(w->pid, NULL, 0);
+}
+
+//tile x y at level z as a mandel5 view. the tile center is -2 + (x+0.5)*4/2^z, both terms
+//are exact doubles so two_sum gives it exactly as hi + lo
+tile_request key_to_request(const tile_key *k)
+{
+    double step = ldexp(4, -k->z);
+    dd re = two_sum(-2, (k->x + 0.5) * step);
+    dd im = two_sum(2, -(k->y + 0.5) * step);
+
+    //mandel5 centers on -center.real + center.im i
+    return (tile_request) {
+        .func = k->func, .root_real = k->root_real, .root_im = k->root_im,
+        .center_real = -re.hi, .center_im = im.hi,
+        .center_lo_real = -re.lo, .center_lo_im = im.lo,
+        .zoom = TILE_PX / step, .iterations = k->iterations,
+        .width = TILE_PX, .height = TILE_PX, .w = TILE_PX, .h = TILE_PX};
+}
+
+//shade a rendered tile into a bmp, NULL if out of memory
+uint8_t *tile_bmp(const tile_key *k, const value_depth *pixels)
+{
+    uint8_t *bmp = malloc(BMP_SIZE);
+    if (!bmp)
+        return NULL;
+    uint8_t *h = bmp;
+    *h++ = 'B';
+    *h++ = 'M';
+    put_u32(&h, BMP_SIZE);
+    put_u32(&h, 0);
+    put_u32(&h, BMP_HEADER);
+    put_u32(&h, 40);
+    put_u32(&h, TILE_PX);
+    put_u32(&h, -TILE_PX);      //negative height, rows go top down like the response
+    put_u32(&h, 1 | 24 << 16);  //planes, bits per pixel
+    put_u32(&h, 0);
+    put_u32(&h, TILE_PX*TILE_PX*3);
+    put_u32(&h, 2835);
+    put_u32(&h, 2835);
+    put_u32(&h, 0);
+    put_u32(&h, 0);
+
+    for (int i = 0; i < TILE_PX*TILE_PX; i++)
+    {
+        unsigned char px[3];
+        shade_bytes(pixels[i].value, pixels[i].depth, k->iterations, px);
+        *h++ = px[2];           //bmp pixels are blue, green, red
+        *h++ = px[1];
+        *h++ = px[0];
+    }
+    return bmp;
+}
+
+//ask the worker for the tile and turn the answer into a bmp, NULL if the worker broke
+uint8_t *render(worker *w, const tile_key *k, uint8_t *response, value_depth *pixels)
+{
+    uint8_t req[TILE_REQUEST_SIZE];
+    tile_request rq = key_to_request(k);
+    encode_request(&rq, req);
+
+    size_t size = TILE_RESPONSE_HEADER + TILE_PX*TILE_PX*TILE_PIXEL_SIZE;
+    if (!write_full(w->to, req, sizeof(req)) || !read_full(w->from, response, size))
+        return NULL;
+    const uint8_t *p = response;
+    if (get_u32(&p) != TILE_MAGIC || get_u32(&p) != rq.id || get_u32(&p) != TILE_PX || get_u32(&p) != TILE_PX)
+        return NULL;
+
+    for (int i = 0; i < TILE_PX*TILE_PX; i++)
+    {
+        pixels[i].value = get_f64(&p);
+        pixels[i].depth = get_u32(&p);
+    }
+    return tile_bmp(k, pixels);
+}
+
+//the same tile rendered right here, the same pixels a worker gives for it
+uint8_t *render_here(const tile_key *k, value_depth *pixels)
+{
+    tile_request rq = key_to_request(k);
+    mandel_view v = request_view(&rq);
+    mandel_prepare(&v, 0);
+    mandel_render(&v, 0, 0, TILE_PX, TILE_PX, pixels, TILE_PX);
+    return tile_bmp(k, pixels);
+}
+
+void *render_thread(void *arg)
+{
+    worker w;
+    uint8_t *response = malloc(TILE_RESPONSE_HEADER + TILE_PX*TILE_PX*TILE_PIXEL_SIZE);
+    value_depth *pixels = malloc(TILE_PX*TILE_PX*sizeof(value_depth));
+    int alive = !in_process && spawn(&w);
+    (void) arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&cache_lock);
+        while (!queue)
+            pthread_cond_wait(&queued, &cache_lock);
+        entry *e = queue;
+        queue = e->qnext;
+        if (!queue)
+            queue_tail = NULL;
+        pthread_mutex_unlock(&cache_lock);
+
+        //a worker that died takes one tile down with it, the next one gets a fresh worker
+        uint8_t *bmp = NULL;
+        if (in_process)
+            bmp = pixels ? render_here(&e->key, pixels) : NULL;
+        else if (!alive)
+            alive = spawn(&w);
+        if (alive && response && pixels && !(bmp = render(&w, &e->key, response, pixels)))
+        {
+            fprintf(stderr, "worker %d failed\n", (int) w.pid);
+            bury(&w);
+            alive = 0;
+        }
+
+        pthread_mutex_lock(&cache_lock);
+        if (bmp)
+        {
+            e->bmp = bmp;
+            push_lru(e);
+            cache_bytes += BMP_SIZE;
+            evict();
+        }
+        else
+        {
+            e->failed = 1;
+            unhash(e);
+        }
+        pthread_cond_broadcast(&tile_done);
+        pthread_mutex_unlock(&cache_lock);
+
+        pthread_mutex_lock(&stats_lock);
+        total.renders++;
+        pthread_mutex_unlock(&stats_lock);
+    }
+    return NULL;
+}
+
+// ===================================
+// http
+// ===================================
+int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+//one line of counters since the snapshot in since, which moves up to now. percentiles over
+//the latest LATENCY_SAMPLES requests since then. sorted is the caller's scratch space
+void stats_line(char *buf, size_t size, counters *since, double *sorted)
+{
+    pthread_mutex_lock(&stats_lock);
+    counters c = total;
+    c.when = now();
+    unsigned requests = c.requests - since->requests, hits = c.hits - since->hits;
+    unsigned n = c.n_latency - since->n_latency;
+    if (n > LATENCY_SAMPLES)
+        n = LATENCY_SAMPLES;
+    for (unsigned i = 0; i < n; i++)
+        sorted[i] = latency[(c.n_latency - n + i) % LATENCY_SAMPLES];
+    snprintf(buf, size, "%.0f req/s, %u%% cache hits, %u shared, %u rendered",
+             requests / (c.when - since->when), requests ? 100 * hits / requests : 0,
+             c.shared - since->shared, c.renders - since->renders);
+    *since = c;
+    pthread_mutex_unlock(&stats_lock);
+
+    if (n)
+    {
+        qsort(sorted, n, sizeof(double), cmp_double);
+        size_t len = strlen(buf);
+        snprintf(buf + len, size - len, ", p50 %.1f ms, p99 %.1f ms",
+                 sorted[n / 2] * 1000, sorted[n * 99 / 100] * 1000);
+    }
+}
+
+void *report_thread(void *arg)
+{
+    static double sorted[LATENCY_SAMPLES];
+    char line[256];
+    counters last = {.when = now()};
+    (void) arg;
+    for (;;)
+    {
+        sleep(REPORT_SECONDS);
+        pthread_mutex_lock(&stats_lock);
+        int idle = total.requests == last.requests;
+        pthread_mutex_unlock(&stats_lock);
+        if (idle)
+            continue;
+        stats_line(line, sizeof(line), &last, sorted);
+        fprintf(stderr, "%s\n", line);
+    }
+    return NULL;
+}
+
+int reply(int fd, const char *status, const char *type, const void *body, size_t size, int keep)
+{
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                     "Cache-Control: %s\r\nConnection: %s\r\n\r\n",
+                     status, type, size, body && status[0] == '2' ? "max-age=86400" : "no-store",
+                     keep ? "keep-alive" : "close");
+    return write_full(fd, head, n) && write_full(fd, body, size);
+}
+
+int reply_text(int fd, const char *status, const char *text, int keep)
+{
+    return reply(fd, status, "text/plain", text, strlen(text), keep);
+}
+
+//parse /func/z/x/y.bmp with optional ?r=re,im&i=iterations
+int parse_tile(const char *path, tile_key *k)
+{
+    int n = 0;
+    unsigned long long x, y;
+    *k = (tile_key) {.iterations = default_iterations};
+
+    if (sscanf(path, "/%d/%d/%llu/%llu.bmp%n", &k->func, &k->z, &x, &y, &n) != 4 || n == 0)
+        return 0;
+    if (k->func < 0 || k->func > 3 || k->z < 0 || k->z > MAX_Z || x >> k->z || y >> k->z)
+        return 0;
+    k->x = x;
+    k->y = y;
+
+    const char *q = path + n;
+    if (*q == '?')
+        q++;
+    while (*q)
+    {
+        if (sscanf(q, "r=%lf,%lf", &k->root_real, &k->root_im) == 2)
+            ;
+        else if (sscanf(q, "i=%d", &k->iterations) == 1)
+        {
+            if (k->iterations <= 0 || k->iterations > 1000000)
+                return 0;
+        }
+        else
+            return 0;
+        q += strcspn(q, "&");
+        if (*q)
+            q++;
+    }
+    return 1;
+}
+
+//one connection, keep-alive until the client closes
+void *connection(void *arg)
+{
+    int fd = (intptr_t) arg;
+    char buf[4096];
+    size_t have = 0;
+
+    for (;;)
+    {
+        char *end;
+        buf[have] = 0;
+        while (!(end = strstr(buf, "\r\n\r\n")))
+        {
+            if (have == sizeof(buf) - 1)
+                goto out;
+            ssize_t got = read(fd, buf + have, sizeof(buf) - 1 - have);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0)
+                goto out;
+            have += got;
+            buf[have] = 0;
+        }
+        double start = now();
+        *end = 0;
+
+        char method[8], path[1024], version[16];
+        if (sscanf(buf, "%7s %1023s HTTP/%15s", method, path, version) != 3)
+        {
+            reply_text(fd, "400 Bad Request", "bad request\n", 0);
+            goto out;
+        }
+        int keep = strcmp(version, "1.0") != 0 && !strcasestr(buf, "\r\nConnection: close");
+
+        //keep anything pipelined after this request
+        size_t used = end + 4 - buf;
+        memmove(buf, buf + used, have - used);
+        have -= used;
+
+        tile_key k;
+        int ok;
+        if (strcmp(method, "GET") != 0)
+            ok = reply_text(fd, "405 Method Not Allowed", "GET only\n", keep);
+        else if (strcmp(path, "/stats") == 0)
+        {
+            //since the previous /stats, apart from what the periodic report sees
+            static counters last_poll;
+            static double sorted[LATENCY_SAMPLES];
+            static pthread_mutex_t poll_lock = PTHREAD_MUTEX_INITIALIZER;
+            char line[256];
+            pthread_mutex_lock(&poll_lock);
+            if (last_poll.when == 0)
+                last_poll.when = started;
+            stats_line(line, sizeof(line), &last_poll, sorted);
+            pthread_mutex_unlock(&poll_lock);
+            strcat(line, "\n");
+            ok = reply_text(fd, "200 OK", line, keep);
+        }
+        else if (!parse_tile(path, &k))
+            ok = reply_text(fd, "404 Not Found", "expected /func/z/x/y.bmp?r=re,im&i=iterations\n", keep);
+        else
+        {
+            entry *e = get_tile(&k);
+            if (!e)
+                ok = reply_text(fd, "503 Service Unavailable", "out of memory\n", keep);
+            else
+            {
+                if (e->bmp)
+                    ok = reply(fd, "200 OK", "image/bmp", e->bmp, BMP_SIZE, keep);
+                else
+                    ok = reply_text(fd, "500 Internal Server Error", "worker failed\n", keep);
+                release(e);
+            }
+
+            pthread_mutex_lock(&stats_lock);
+            latency[total.n_latency++ % LATENCY_SAMPLES] = now() - start;
+            total.requests++;
+            pthread_mutex_unlock(&stats_lock);
+        }
+        if (!ok || !keep)
+            break;
+    }
+out:
+    close(fd);
+    return NULL;
+}
+
+int listen_on(const char *unix_path, int port)
+{
+    int fd;
+    if (unix_path)
+    {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (strlen(unix_path) >= sizeof(addr.sun_path))
+            return -1;
+        strcpy(addr.sun_path, unix_path);
+        unlink(unix_path);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+            return -1;
+    }
+    else
+    {
+        struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port),
+                                   .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+        int on = 1;
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+            return -1;
+    }
+    return listen(fd, 128) < 0 ? -1 : fd;
+}
+
+void usage(void)
+{
+    printf("tileserver [-p port | -u socket] [-n renderers] [-w worker cmd | -w -] [-m cache MB]\n"
+           "           [-i iterations]\n");
+}
+
+int main(int argc, char* argv[])
+{
+    int port = 8080, n = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *unix_path = NULL;
+
+    for (int i = 1; i<argc; i++)
+    {
+        if (argv[i][0] != '-' || argv[i][1] == 0 || i + 1 >= argc)
+        {
+            usage();
+            return 1;
+        }
+        switch (argv[i][1])
+        {
+            case 'p': port = atoi(argv[i+1]); break;
+            case 'u': unix_path = argv[i+1]; break;
+            case 'n': n = atoi(argv[i+1]); break;
+            case 'w': worker_cmd = argv[i+1]; in_process = strcmp(worker_cmd, "-") == 0; break;
+            case 'm': cache_limit = (size_t) atoi(argv[i+1]) << 20; break;
+            case 'i': default_iterations = atoi(argv[i+1]); break;
+            default:
+                usage();
+                return 1;
+        }
+        i++;
+    }
+    if (n <= 0 || n > MAX_RENDERERS || default_iterations <= 0)
+    {
+        usage();
+        return 1;
+    }
+
+    started = now();
+    signal(SIGPIPE, SIG_IGN);
+    int fd = listen_on(unix_path, port);
+    if (fd < 0)
+    {
+        perror("listen");
+        return 1;
+    }
+
+    pthread_t t;
+    for (int i = 0; i < n; i++)
+        pthread_create(&t, NULL, render_thread, NULL);
+    pthread_create(&t, NULL, report_thread, NULL);
+    if (unix_path)
+        fprintf(stderr, "serving on %s with %d workers\n", unix_path, n);
+    else
+        fprintf(stderr, "serving on http://127.0.0.1:%d/ with %d workers\n", port, n);
+
+    for (;;)
+    {
+        int c = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if (c < 0)
+            continue;
+        if (pthread_create(&t, NULL, connection, (void *) (intptr_t) c) != 0)
+        {
+            close(c);
+            continue;
+        }
+        pthread_detach(t);
+    }
+}